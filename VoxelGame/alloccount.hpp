@@ -0,0 +1,38 @@
+#ifndef INCLUDED_ALLOC_COUNT_HPP
+#define INCLUDED_ALLOC_COUNT_HPP
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+/*
+Replaces the global operator new and delete with ones that count every
+allocation in the process, on all threads. For benchmarks: include it from
+exactly one source file of the program. Array and sized forms go through
+these.
+
+The replacements are kept out of line. Inlined into a caller, GCC sees
+free() of memory that came from operator new and warns that they're
+mismatched.
+*/
+
+inline std::atomic<size_t> num_allocs(0);
+
+#if defined(__GNUC__)
+#define ALLOC_COUNT_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_COUNT_NOINLINE
+#endif
+
+ALLOC_COUNT_NOINLINE void *operator new(size_t size)
+{
+    num_allocs++;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_COUNT_NOINLINE void operator delete(void *p) noexcept { free(p); }
+ALLOC_COUNT_NOINLINE void operator delete(void *p, size_t) noexcept { free(p); }
+
+#endif
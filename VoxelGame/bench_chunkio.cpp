@@ -0,0 +1,575 @@
+/*
+Headless chunk storage benchmark. Fills chunks with a few kinds of
+deterministic content, then times, for each world:
+
+    save, load      Chunk::save and Chunk::load through the region files,
+                    with each ChunkCodec setting
+    pack, unpack    DataContainer::pack and unpack of the block data
+                    containers alone, for worlds that have them
+    world load      World::getChunk of chunks not in memory, and
+    world unload    World::unloadChunk and dequeueUnloadedChunk, through
+                    the SaveQueue to disk. Once per world, with the codec
+                    the game uses.
+
+Two more "worlds", named512 and named4096, are a single DataContainer of
+that many named items:
+
+    build index     setNamedItem of every item, then getNamedItem of each,
+    build scan      with the name index and with scanning alone. Each
+                    container counts as a chunk.
+
+Every loaded or unpacked chunk, and every item looked up, is checked
+against the one saved, and the exit status is 1 if any doesn't match.
+
+    bench_chunkio [--data DIR] [--storage DIR] [--chunks N] [--iterations N]
+                  [--only WORLD] [--codec CODEC] [--json FILE]
+
+WORLD is empty, flat, palettes, terrain, noise, dense, named512 or
+named4096. CODEC is raw, palette, deflate or palette+deflate; the default
+is all of them. --json writes the results to FILE as well.
+
+Rates are per chunk and per byte moved: stored bytes for save and load,
+packed container bytes for pack, unpack and build. p50 and p99 are of single
+chunks, in microseconds; for world unload they're what the caller waits
+for, while the rate includes the SaveQueue writing everything out.
+allocs/chunk counts operator new across all threads.
+
+--data is the directory holding blocks/ and textures/ (default "."), needed
+for block types; the exit status is 1 if one it uses can't be loaded.
+Region files already in --storage (default "bench_storage") are deleted
+first. Saves go to the OS page cache and are never synced, so this measures
+encoding and file access more than the disk.
+*/
+
+#include "chunk.hpp"
+#include "block.hpp"
+#include "world.hpp"
+#include "filelocator.hpp"
+#include "regionfile.hpp"
+#include "chunkcodec.hpp"
+#include "savequeue.hpp"
+#include "editjournal.hpp"
+#include "time.hpp"
+#include "alloccount.hpp"
+#include "benchutil.hpp"
+#include <atomic>
+#include <filesystem>
+#include <algorithm>
+#include <unordered_set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+void register_static_blocks();
+void init_dirt_block();
+
+// Nothing but air
+static void fillEmpty(Chunk *, Random&)
+{
+}
+
+static void fillFlat(Chunk *c, Random&)
+{
+    BlockPos corner = BlockPos::getBlockPos(c->getChunkPos());
+    for (int y=0; y<12; y++) {
+        for (int z=0; z<16; z++) {
+            for (int x=0; x<16; x++) {
+                c->genBlock(corner.offset(x, y, z), y < 11 ? "stone" : "dirt");
+            }
+        }
+    }
+}
+
+// Each chunk has its own palette of 1 to 12 types and air, laid down in
+// runs of random length, so cell arrays come in every width
+static void fillPalettes(Chunk *c, Random& rng)
+{
+    static const char *names[] = { "stone", "brick", "wood", "steel", "cobblestone", "marble",
+        "concrete", "carpet", "wood_wedge", "wood_slab", "windowpane", "numbercube" };
+    const int num_names = sizeof(names) / sizeof(names[0]);
+    const char *palette[num_names + 1];
+    int palette_size = 1 + rng.range(num_names);
+    palette[0] = 0;
+    for (int i=1; i<=palette_size; i++) palette[i] = names[rng.range(num_names)];
+
+    for (int i=0; i<sizes::chunk_storage_size; ) {
+        int run = 1 + rng.range(64);
+        const char *name = palette[rng.range(palette_size + 1)];
+        int rotation = rng.range(4) ? 0 : rng.range(24);
+        for (; run && i<sizes::chunk_storage_size; run--, i++) {
+            if (!name) continue;
+            c->genBlock(c->decodeIndex(i), name);
+            if (rotation) c->setRotation(c->getBlock((uint16_t)i).get(), rotation);
+        }
+    }
+}
+
+static int terrainHeight(int gx, int gz)
+{
+    return 8 + (int)(3 * sin(gx * 0.07) + 2 * cos(gz * 0.05) + 1.5 * sin((gx + gz) * 0.13));
+}
+
+static void buildTerrain(Chunk *c)
+{
+    BlockPos corner = BlockPos::getBlockPos(c->getChunkPos());
+    for (int z=0; z<16; z++) {
+        for (int x=0; x<16; x++) {
+            int height = terrainHeight(corner.X + x, corner.Z + z);
+            for (int y=0; y<=height; y++) c->genBlock(corner.offset(x, y, z), y < height ? "stone" : "dirt");
+        }
+    }
+}
+
+// The same ground is built in the World this many chunks up, where dirt
+// repaints against its neighbors as in the game
+static const int terrain_staging_y = 4;
+
+// Rolling ground with dirt on top. Height fields are what the game's
+// repaint gives it: only dirt along a step has one, mostly flat or sloped
+// at the block's edge.
+static void fillTerrain(Chunk *c, Random&)
+{
+    static std::unordered_set<uint64_t> built;
+    ChunkPos cp = c->getChunkPos();
+    ChunkPos staging_pos(cp.X, cp.Y + terrain_staging_y, cp.Z);
+    for (int dz=-1; dz<=1; dz++) {
+        for (int dx=-1; dx<=1; dx++) {
+            ChunkPos np(staging_pos.X + dx, staging_pos.Y, staging_pos.Z + dz);
+            if (!built.insert(np.packed()).second) continue;
+            buildTerrain(World::instance.getChunk(np));
+        }
+    }
+    Chunk *staging = World::instance.getChunk(staging_pos);
+    staging->repaintAllBlocks();
+    for (int pass=0; pass<100 && World::instance.doBlockUpdates(); pass++) {}
+
+    buildTerrain(c);
+    for (int i=0; i<sizes::chunk_storage_size; i++) {
+        BlockPtr from = staging->getBlock((uint16_t)i);
+        HeightField *h = from ? from->getHeights(false) : 0;
+        if (h) memcpy(c->getBlock((uint16_t)i)->getHeights(true)->code, h->code, sizeof(h->code));
+    }
+}
+
+// Every block random, with random rotations
+static void fillNoise(Chunk *c, Random& rng)
+{
+    static const char *names[] = { "stone", "brick", "wood", "steel", "wood_wedge", "wood_slab" };
+    for (int i=0; i<sizes::chunk_storage_size; i++) {
+        BlockPos pos = c->decodeIndex(i);
+        if (!rng.range(4)) continue;
+        c->genBlock(pos, names[rng.range(6)]);
+        c->setRotation(c->getBlock((uint16_t)i).get(), rng.range(24));
+    }
+}
+
+// Two layers of dirt over stone, every dirt block with a data container of
+// named, indexed and nested items
+static void fillDense(Chunk *c, Random& rng)
+{
+    BlockPos corner = BlockPos::getBlockPos(c->getChunkPos());
+    for (int y=0; y<8; y++) {
+        for (int z=0; z<16; z++) {
+            for (int x=0; x<16; x++) {
+                BlockPos pos = corner.offset(x, y, z);
+                if (y < 6) {
+                    c->genBlock(pos, "stone");
+                    continue;
+                }
+                c->genBlock(pos, "dirt");
+                DataContainerPtr dc = c->getBlock(pos)->getData(true);
+                dc->setNamedItem("owner", DataItem::makeString("player" + std::to_string(rng.range(16))));
+                dc->setNamedItem("placed", DataItem::makeInt64(rng.next()));
+                dc->setNamedItem("moisture", DataItem::makeFloat(rng.range(1000) * 0.001f));
+                DataItemPtr tags = DataItem::makeInt16Array(8);
+                for (int i=0; i<8; i++) tags->getInt16Array()[i] = rng.range(300);
+                dc->setNamedItem("tags", tags);
+                DataContainerPtr inv = DataContainer::makeContainer();
+                int slots = rng.range(5);
+                for (int i=0; i<slots; i++) {
+                    DataContainerPtr slot = DataContainer::makeContainer();
+                    slot->setNamedItem("item", DataItem::makeString(i & 1 ? "seed" : "pebble"));
+                    slot->setNamedItem("count", DataItem::makeInt8(1 + rng.range(64)));
+                    inv->setIndexedItem(i, DataItem::wrapContainer(slot));
+                }
+                dc->setNamedItem("inventory", DataItem::wrapContainer(inv));
+            }
+        }
+    }
+}
+
+struct Scenario {
+    const char *name;
+    void (*fill)(Chunk *c, Random& rng);
+};
+
+static const Scenario scenarios[] = {
+    { "empty", fillEmpty },
+    { "flat", fillFlat },
+    { "palettes", fillPalettes },
+    { "terrain", fillTerrain },
+    { "noise", fillNoise },
+    { "dense", fillDense },
+};
+
+struct Codec {
+    const char *name;
+    bool palette, deflate;
+};
+
+static const Codec codecs[] = {
+    { "raw", false, false },
+    { "palette", true, false },
+    { "deflate", false, true },
+    { "palette+deflate", true, true },
+};
+
+// What the game saves with
+static const Codec& game_codec = codecs[1];
+
+// Scenarios are placed far apart so they don't share region files
+static const int scenario_spacing = 64;
+
+static bool sameContainer(DataContainerPtr a, DataContainerPtr b)
+{
+    if (!a || !b) return !a == !b;
+    ByteWriter pa, pb;
+    a->pack(pa);
+    b->pack(pb);
+    return pa.size() == pb.size() && !memcmp(pa.data(), pb.data(), pa.size());
+}
+
+static bool sameChunk(Chunk *a, Chunk *b)
+{
+    for (int i=0; i<sizes::chunk_storage_size; i++) {
+        BlockPtr ba = a->getBlock((uint16_t)i), bb = b->getBlock((uint16_t)i);
+        if (!ba || !bb) {
+            if (!ba != !bb) return false;
+            continue;
+        }
+        if (ba->getBlockType() != bb->getBlockType()) return false;
+        if (a->getRotation((uint16_t)i) != b->getRotation((uint16_t)i)) return false;
+        if (!sameContainer(ba->getData(false), bb->getData(false))) return false;
+        HeightField *ha = ba->getHeights(false), *hb = bb->getHeights(false);
+        if (!ha != !hb) return false;
+        if (ha && memcmp(ha->code, hb->code, sizeof(ha->code))) return false;
+    }
+    return true;
+}
+
+struct Result {
+    const char *world;
+    const char *codec;
+    const char *op;
+    size_t chunks;          // Timed, over all iterations
+    double seconds;
+    size_t bytes, allocs;
+    std::vector<double> latencies;      // Seconds, one per chunk
+    bool ok;
+
+    Result(const char *w, const char *c, const char *o) : world(w), codec(c), op(o), chunks(0),
+        seconds(0), bytes(0), allocs(0), ok(true) {}
+
+    double percentile(double p) const {
+        if (latencies.empty()) return 0;
+        std::vector<double> sorted(latencies);
+        size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+        return sorted[i];
+    }
+};
+
+// Times one chunk's worth of work into res
+struct Timer {
+    Result& res;
+    size_t allocs_before;
+    double start;
+    Timer(Result& r) : res(r), allocs_before(num_allocs), start(ref::currentTime()) {}
+    ~Timer() {
+        double t = ref::currentTime() - start;
+        res.seconds += t;
+        res.latencies.push_back(t);
+        res.allocs += num_allocs - allocs_before;
+        res.chunks++;
+    }
+};
+
+static size_t storedBytes(const std::vector<Chunk *>& chunks)
+{
+    std::vector<char> bytes;
+    size_t total = 0;
+    for (Chunk *c : chunks) {
+        if (RegionStore::instance.readChunk(c->getChunkPos(), bytes)) total += bytes.size();
+    }
+    return total;
+}
+
+static void runSaveLoad(const Scenario& sc, const Codec& codec, const std::vector<Chunk *>& saved,
+    const std::vector<Chunk *>& loaded, int iterations, std::vector<Result>& results)
+{
+    ChunkCodec::instance.palette = codec.palette;
+    ChunkCodec::instance.deflate = codec.deflate;
+    Result save(sc.name, codec.name, "save"), load(sc.name, codec.name, "load");
+
+    for (int it=0; it<iterations; it++) {
+        for (Chunk *c : saved) {
+            c->needs_save = true;
+            Timer t(save);
+            c->save();
+        }
+        for (Chunk *c : loaded) {
+            Timer t(load);
+            if (!c->load()) load.ok = false;
+        }
+    }
+
+    for (size_t i=0; i<saved.size(); i++) {
+        if (!sameChunk(saved[i], loaded[i])) {
+            if (load.ok) printf("%s: chunk %s differs after loading\n", sc.name, saved[i]->getChunkPos().toString().c_str());
+            load.ok = false;
+        }
+    }
+    save.bytes = load.bytes = storedBytes(saved) * iterations;
+    results.push_back(save);
+    results.push_back(load);
+}
+
+// The block data containers on their own, packed back to back per chunk
+static void runContainers(const Scenario& sc, const std::vector<Chunk *>& saved, int iterations,
+    std::vector<Result>& results)
+{
+    std::vector<std::vector<DataContainerPtr>> containers(saved.size());
+    size_t total = 0;
+    for (size_t i=0; i<saved.size(); i++) {
+        for (int j=0; j<sizes::chunk_storage_size; j++) {
+            BlockPtr b = saved[i]->getBlock((uint16_t)j);
+            DataContainerPtr dc = b ? b->getData(false) : DataContainerPtr();
+            if (dc) containers[i].push_back(dc);
+        }
+        total += containers[i].size();
+    }
+    if (!total) return;
+
+    Result pack(sc.name, "-", "pack"), unpack(sc.name, "-", "unpack");
+    std::vector<ByteWriter> packed(saved.size());
+    std::vector<DataContainerPtr> unpacked;
+    for (int it=0; it<iterations; it++) {
+        for (size_t i=0; i<saved.size(); i++) {
+            packed[i].clear();
+            Timer t(pack);
+            for (DataContainerPtr& dc : containers[i]) dc->pack(packed[i]);
+        }
+        for (size_t i=0; i<saved.size(); i++) {
+            unpacked.clear();
+            {
+                Timer t(unpack);
+                ByteReader in(packed[i].data(), packed[i].size());
+                while (in.ok() && !in.atEnd()) unpacked.push_back(DataContainer::unpack(in));
+                if (!in.ok()) unpack.ok = false;
+            }
+            if (it) continue;
+            bool same = unpacked.size() == containers[i].size();
+            for (size_t j=0; same && j<unpacked.size(); j++) same = sameContainer(unpacked[j], containers[i][j]);
+            if (!same && unpack.ok) printf("%s: containers of chunk %s differ after unpacking\n", sc.name, saved[i]->getChunkPos().toString().c_str());
+            if (!same) unpack.ok = false;
+        }
+    }
+    for (const ByteWriter& b : packed) pack.bytes += b.size();
+    pack.bytes *= iterations;
+    unpack.bytes = pack.bytes;
+    results.push_back(pack);
+    results.push_back(unpack);
+}
+
+// Through World, as when the player moves. Chunks come back in as new
+// Chunks, which are never freed, so this is one pass.
+static void runWorld(const Scenario& sc, const std::vector<Chunk *>& saved, std::vector<Result>& results)
+{
+    ChunkCodec::instance.palette = game_codec.palette;
+    ChunkCodec::instance.deflate = game_codec.deflate;
+    for (Chunk *c : saved) {
+        c->needs_save = true;
+        c->save();
+    }
+
+    Result load(sc.name, game_codec.name, "world load"), unload(sc.name, game_codec.name, "world unload");
+    for (Chunk *c : saved) {
+        Chunk *wc;
+        {
+            Timer t(load);
+            wc = World::instance.getChunk(c->getChunkPos());
+        }
+        if (!wc || !sameChunk(c, wc)) {
+            if (load.ok) printf("%s: chunk %s differs after loading into the world\n", sc.name, c->getChunkPos().toString().c_str());
+            load.ok = false;
+        }
+        // As if it had been played in
+        if (wc) wc->needs_save = true;
+    }
+
+    size_t allocs_before = num_allocs;
+    double start = ref::currentTime();
+    for (Chunk *c : saved) {
+        Timer t(unload);
+        Chunk *wc = World::instance.getChunk(c->getChunkPos(), World::NoLoad);
+        World::instance.unloadChunkLocked(c->getChunkPos());
+        // Due to leave the unload queue right away
+        if (wc) wc->time_unloaded = 0;
+        World::instance.dequeueUnloadedChunk();
+    }
+    SaveQueue::instance.flush();
+    unload.seconds = ref::currentTime() - start;
+    unload.allocs = num_allocs - allocs_before;
+
+    load.bytes = unload.bytes = storedBytes(saved);
+    results.push_back(load);
+    results.push_back(unload);
+}
+
+// One container of n named items, built and looked up item by item
+static void runNamedItems(const char *name, int n, int iterations, std::vector<Result>& results)
+{
+    std::vector<std::string> names(n);
+    for (int i=0; i<n; i++) names[i] = "item" + std::to_string(i);
+
+    size_t threshold = DataContainer::index_threshold;
+    for (int scan=0; scan<2; scan++) {
+        DataContainer::index_threshold = scan ? (size_t)-1 : threshold;
+        Result res(name, "-", scan ? "build scan" : "build index");
+        ByteWriter packed;
+        for (int it=0; it<iterations; it++) {
+            DataContainerPtr dc;
+            {
+                Timer t(res);
+                dc = DataContainer::makeContainer();
+                for (int i=0; i<n; i++) dc->setNamedItem(names[i], DataItem::makeInt32(i));
+                for (int i=0; i<n; i++) {
+                    DataItemPtr item = dc->getNamedItem(names[i]);
+                    if (!item || item->getInt32() != i) res.ok = false;
+                }
+            }
+            if (it) continue;
+            packed.clear();
+            dc->pack(packed);
+        }
+        res.bytes = packed.size() * iterations;
+        results.push_back(res);
+    }
+    DataContainer::index_threshold = threshold;
+}
+
+static void runScenario(int index, const char *only_codec, int num_chunks, int iterations, std::vector<Result>& results)
+{
+    const Scenario& sc(scenarios[index]);
+
+    // A slab of chunks 16 wide, as many deep as it takes
+    std::vector<Chunk *> saved, loaded;
+    Random rng(1234 + index);
+    for (int i=0; i<num_chunks; i++) {
+        ChunkPos cp(index * scenario_spacing + (i & 15), 0, i >> 4);
+        Chunk *c = new Chunk(cp);
+        sc.fill(c, rng);
+        saved.push_back(c);
+        loaded.push_back(new Chunk(cp));
+    }
+
+    for (const Codec& codec : codecs) {
+        if (only_codec && strcmp(only_codec, codec.name)) continue;
+        runSaveLoad(sc, codec, saved, loaded, iterations, results);
+    }
+    runContainers(sc, saved, iterations, results);
+    runWorld(sc, saved, results);
+}
+
+static void writeJson(FILE *f, const std::vector<Result>& results, int num_chunks, int iterations)
+{
+    fprintf(f, "{\n  \"chunks\": %d,\n  \"iterations\": %d,\n  \"results\": [", num_chunks, iterations);
+    for (size_t i=0; i<results.size(); i++) {
+        const Result& r(results[i]);
+        fprintf(f, "%s\n    {\"world\": \"%s\", \"codec\": \"%s\", \"op\": \"%s\", \"chunks\": %zu, \"seconds\": %.6f, "
+            "\"chunks_per_second\": %.1f, \"mb_per_second\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+            "\"bytes_per_chunk\": %.1f, \"allocs_per_chunk\": %.2f, \"ok\": %s}",
+            i ? "," : "", r.world, r.codec, r.op, r.chunks, r.seconds,
+            r.chunks / r.seconds, r.bytes / r.seconds / (1 << 20), r.percentile(0.5) * 1e6, r.percentile(0.99) * 1e6,
+            (double)r.bytes / r.chunks, (double)r.allocs / r.chunks, r.ok ? "true" : "false");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *only = 0;
+    const char *only_codec = 0;
+    const char *json = 0;
+    const char *storage_dir = "bench_storage";
+    int num_chunks = 256, iterations = 5;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--data") && i+1 < argc) {
+            FileLocator::instance.setConfigDir(argv[++i]);
+        } else if (!strcmp(argv[i], "--storage") && i+1 < argc) {
+            storage_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--chunks") && i+1 < argc) {
+            num_chunks = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--only") && i+1 < argc) {
+            only = argv[++i];
+        } else if (!strcmp(argv[i], "--codec") && i+1 < argc) {
+            only_codec = argv[++i];
+        } else if (!strcmp(argv[i], "--json") && i+1 < argc) {
+            json = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--data DIR] [--storage DIR] [--chunks N] [--iterations N] [--only WORLD] [--codec CODEC] [--json FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+    if (num_chunks < 1) num_chunks = 1;
+    if (num_chunks > 16 * scenario_spacing) num_chunks = 16 * scenario_spacing;
+    FileLocator::instance.setStorageDir(storage_dir);
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(storage_dir, ec)) {
+        if (entry.path().filename().string().compare(0, 7, "region(") == 0) std::filesystem::remove(entry.path(), ec);
+    }
+
+    register_static_blocks();
+    init_dirt_block();
+    if (!haveBlockTypes({ "stone", "dirt", "brick", "wood", "steel", "cobblestone", "marble", "concrete",
+        "carpet", "wood_wedge", "wood_slab", "windowpane", "numbercube" })) return 1;
+    // The benchmark saves chunks itself
+    EditJournal::instance.enabled = false;
+
+    std::vector<Result> results;
+    for (int i=0; i<(int)(sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+        if (only && strcmp(only, scenarios[i].name)) continue;
+        runScenario(i, only_codec, num_chunks, iterations, results);
+    }
+    if (!only || !strcmp(only, "named512")) runNamedItems("named512", 512, iterations, results);
+    if (!only || !strcmp(only, "named4096")) runNamedItems("named4096", 4096, iterations, results);
+    World::instance.stopLoadSaveThread();
+
+    bool ok = true;
+    printf("\n%-9s %-15s %-12s %7s %10s %9s %9s %9s %11s %12s\n", "world", "codec", "op", "chunks", "chunks/s", "MB/s",
+        "p50 us", "p99 us", "bytes/chunk", "allocs/chunk");
+    for (const Result& r : results) {
+        printf("%-9s %-15s %-12s %7zu %10.1f %9.1f %9.1f %9.1f %11.1f %12.1f%s\n", r.world, r.codec, r.op, r.chunks,
+            r.chunks / r.seconds, r.bytes / r.seconds / (1 << 20), r.percentile(0.5) * 1e6, r.percentile(0.99) * 1e6,
+            (double)r.bytes / r.chunks, (double)r.allocs / r.chunks, r.ok ? "" : "  FAILED");
+        if (!r.ok) ok = false;
+    }
+    printf("%s\n", ok ? "round trip OK" : "round trip FAILED");
+
+    if (json) {
+        FILE *f = fopen(json, "w");
+        if (!f) {
+            fprintf(stderr, "Unable to write %s\n", json);
+            return 1;
+        }
+        writeJson(f, results, num_chunks, iterations);
+        fclose(f);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+/*
+Headless GeometryArena and DrawList check. Needs EGL with surfaceless
+contexts, such as Mesa llvmpipe, and a GL 3.3 core context. Two parts:
+
+    churn       random uploads and frees of 1 to 700 quads into small pages.
+                Every 1000 operations the live ranges must not overlap or
+                run off their page, and used plus free vertices must cover
+                every page. Once everything is freed, each page must have
+                coalesced back into a single free range.
+    draw        a 4x3x4 chunk terrain meshed around two different centers,
+                drawn into a 256x256 framebuffer through one DrawList for
+                all chunks and again with one DrawList per chunk, which
+                keeps other chunks' ranges out of each multi-draw. Then
+                every chunk is remeshed twice without drawing and the whole
+                thing drawn again. All three images must be the same.
+
+Exits with status 1 if anything doesn't hold.
+
+    bench_geometryarena [--data DIR] [--storage DIR] [--ops N]
+
+--data is the directory holding blocks/, textures/ and shaders/ (default
+"."). Region files already in --storage (default "bench_storage") are
+deleted first. Without a display, Mesa may need to be told:
+
+    EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 bench_geometryarena
+*/
+
+#include <EGL/egl.h>
+#include "gl_includes.hpp"
+#include "world.hpp"
+#include "chunkview.hpp"
+#include "geometryarena.hpp"
+#include "shader.hpp"
+#include "cameramodel.hpp"
+#include "filelocator.hpp"
+#include "editjournal.hpp"
+#include "time.hpp"
+#include "benchutil.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+void register_static_blocks();
+void init_dirt_block();
+
+static const int width = 256, height = 256;
+
+static bool glOk(const char *what)
+{
+    GLenum e = glGetError();
+    if (e) printf("GL error 0x%x after %s\n", e, what);
+    return !e;
+}
+
+static bool makeContext()
+{
+    EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (!eglInitialize(dpy, &major, &minor)) {
+        printf("eglInitialize failed\n");
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint config_attr[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    eglChooseConfig(dpy, config_attr, &config, 1, &num_configs);
+    EGLint context_attr[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext ctx = eglCreateContext(dpy, num_configs ? config : 0, EGL_NO_CONTEXT, context_attr);
+    if (ctx == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        printf("Unable to make a surfaceless GL 3.3 core context (EGL error 0x%x)\n", eglGetError());
+        return false;
+    }
+    printf("GL: %s / %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+}
+
+// Live ranges are disjoint and inside their pages, and with the free lists
+// they account for every page
+static bool checkRanges(GeometryArena& arena, std::vector<GeometryArena::Range> live)
+{
+    std::sort(live.begin(), live.end(), [](const GeometryArena::Range& a, const GeometryArena::Range& b) {
+        return a.page != b.page ? a.page < b.page : a.first < b.first;
+    });
+    size_t used = 0;
+    for (size_t i=0; i<live.size(); i++) {
+        const GeometryArena::Range& r(live[i]);
+        used += r.count;
+        if (r.first + r.count > arena.pageCapacity(r.page)) {
+            printf("range %u+%u runs off page %d\n", r.first, r.count, r.page);
+            return false;
+        }
+        if (i && live[i-1].page == r.page && live[i-1].first + live[i-1].count > r.first) {
+            printf("ranges overlap at %u in page %d\n", r.first, r.page);
+            return false;
+        }
+    }
+    size_t capacity = arena.capacityBytes() / (GeometryArena::floats_per_vertex * sizeof(float));
+    if (used != arena.used_vertices || used + arena.freeVertices() != capacity) {
+        printf("vertices don't add up: used %zu (arena says %zu), free %zu, capacity %zu\n",
+            used, arena.used_vertices, arena.freeVertices(), capacity);
+        return false;
+    }
+    return true;
+}
+
+static bool runChurn(int ops)
+{
+    GeometryArena& arena(GeometryArena::instance);
+    uint32_t saved_page_vertices = arena.page_vertices;
+    arena.page_vertices = 1 << 14;
+
+    uint32_t seed = 12345;
+    auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+
+    std::vector<GeometryArena::Range> live;
+    RenderData data(3);
+    double start = ref::currentTime();
+    for (int op=0; op<ops; op++) {
+        if (live.empty() || next() % 3) {
+            int quads = 1 + next() % 700;
+            data.clear();
+            data.total_vertices = quads * 4;
+            data.vertices.assign(quads * 12, 1.0f);
+            data.normals.assign(quads * 12, 0.0f);
+            data.texcoords.assign(quads * 12, 0.0f);
+            live.push_back(arena.upload(data));
+        } else {
+            size_t i = next() % live.size();
+            arena.free(live[i]);
+            live[i] = live.back();
+            live.pop_back();
+        }
+        if (op % 1000 == 0 && !checkRanges(arena, live)) return false;
+    }
+    double seconds = ref::currentTime() - start;
+    if (!glOk("churn") || !checkRanges(arena, live)) return false;
+
+    printf("churn: %d ops in %.3f s, %zu pages, %zu free ranges with %zu ranges live\n", ops, seconds,
+        arena.numPages(), arena.numFreeRanges(), live.size());
+    for (GeometryArena::Range& r : live) arena.free(r);
+    bool ok = arena.numFreeRanges() == arena.numPages() && !arena.used_vertices;
+    printf("churn: %zu free ranges in %zu pages after freeing everything%s\n", arena.numFreeRanges(), arena.numPages(),
+        ok ? "" : "  FAILED");
+    arena.page_vertices = saved_page_vertices;
+    return ok;
+}
+
+static BlockPos meshCenter(size_t i)
+{
+    return BlockPos(i % 2 ? 100 : 10, 40, 10);
+}
+
+static void drawFrame(std::vector<Chunk *>& chunks, Shader& shader, CameraModel& camera, bool per_chunk,
+    std::vector<unsigned char>& pixels, int& calls)
+{
+    static DrawList list;
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    calls = 0;
+    list.clear();
+    for (Chunk *c : chunks) {
+        c->getView()->addDraws(list, &shader);
+        if (per_chunk) {
+            calls += list.submit(&camera);
+            list.clear();
+        }
+    }
+    if (!per_chunk) calls += list.submit(&camera);
+    RenderManager::instance.deleteDeadRendererQueue();
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+static int countDiffering(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b)
+{
+    int n = 0;
+    for (int i=0; i<width * height; i++) {
+        if (memcmp(&a[i*4], &b[i*4], 4)) n++;
+    }
+    return n;
+}
+
+static bool runDraw()
+{
+    std::vector<Chunk *> chunks;
+    for (int y=0; y<3; y++) {
+        for (int z=0; z<4; z++) {
+            for (int x=0; x<4; x++) chunks.push_back(World::instance.getChunk(ChunkPos(x, y, z)));
+        }
+    }
+    for (int z=0; z<64; z++) {
+        for (int x=0; x<64; x++) {
+            int h = 20 + (int)(6 * sin(x * 0.1) + 5 * cos(z * 0.13));
+            for (int y=1; y<=h; y++) {
+                BlockPos p(x, y, z);
+                World::instance.getChunk(p.getChunkPos(), World::NoLoad)->genBlock(p, y < h ? (x % 7 ? "stone" : "brick") : "dirt");
+            }
+        }
+    }
+    for (Chunk *c : chunks) c->repaintAllBlocks();
+    for (int pass=0; pass<100 && World::instance.doBlockUpdates(); pass++) {}
+    for (size_t i=0; i<chunks.size(); i++) chunks[i]->getView()->computeUpdates(meshCenter(i));
+
+    GLuint fbo, color, depth;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    glViewport(0, 0, width, height);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.1, 0.2, 0.3, 1);
+
+    Shader shader("vertex_block.glsl", "fragment_block.glsl");
+    shader.setMat4("projection", glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 500.0f));
+    CameraModel camera(glm::dvec3(32, 60, -20), 90, -35);
+    if (!glOk("setup")) return false;
+
+    std::vector<unsigned char> merged(width * height * 4), separate(width * height * 4), republished(width * height * 4);
+    int merged_calls, separate_calls, republished_calls;
+    drawFrame(chunks, shader, camera, false, merged, merged_calls);
+    drawFrame(chunks, shader, camera, true, separate, separate_calls);
+    // Republish twice without drawing, so the first packet's ranges are
+    // freed and reused
+    for (int rep=0; rep<2; rep++) {
+        for (size_t i=0; i<chunks.size(); i++) {
+            chunks[i]->getView()->markChunkUpdated();
+            chunks[i]->getView()->computeUpdates(meshCenter(i));
+        }
+    }
+    drawFrame(chunks, shader, camera, false, republished, republished_calls);
+    if (!glOk("drawing")) return false;
+
+    int background = 0;
+    for (int i=0; i<width * height; i++) {
+        if (merged[i*4] == 25 && merged[i*4+1] == 51) background++;
+    }
+    int differ_separate = countDiffering(merged, separate);
+    int differ_republished = countDiffering(merged, republished);
+    GeometryArena& arena(GeometryArena::instance);
+    printf("draw: %d calls for all chunks, %d one chunk at a time, %d after remeshing\n", merged_calls,
+        separate_calls, republished_calls);
+    printf("draw: %d of %d pixels are background; %d differ one chunk at a time, %d after remeshing\n",
+        background, width * height, differ_separate, differ_republished);
+    printf("draw: arena has %zu pages, %.1f of %.1f MB used, %zu free ranges\n", arena.numPages(),
+        arena.usedBytes() / 1048576.0, arena.capacityBytes() / 1048576.0, arena.numFreeRanges());
+    // An empty picture would match itself
+    bool ok = !differ_separate && !differ_republished && background < width * height;
+    if (!ok) printf("draw FAILED\n");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *storage_dir = "bench_storage";
+    int ops = 20000;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--data") && i+1 < argc) {
+            FileLocator::instance.setConfigDir(argv[++i]);
+        } else if (!strcmp(argv[i], "--storage") && i+1 < argc) {
+            storage_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--ops") && i+1 < argc) {
+            ops = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--data DIR] [--storage DIR] [--ops N]\n", argv[0]);
+            return 1;
+        }
+    }
+    FileLocator::instance.setStorageDir(storage_dir);
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(storage_dir, ec)) {
+        if (entry.path().filename().string().compare(0, 7, "region(") == 0) std::filesystem::remove(entry.path(), ec);
+    }
+
+    if (!makeContext()) return 1;
+    register_static_blocks();
+    init_dirt_block();
+    if (!haveBlockTypes({ "stone", "brick", "dirt" })) return 1;
+    // Nothing here is worth keeping
+    EditJournal::instance.enabled = false;
+
+    bool ok = runChurn(ops);
+    if (!runDraw()) ok = false;
+    printf("%s\n", ok ? "geometry arena OK" : "geometry arena FAILED");
+    return ok ? 0 : 1;
+}
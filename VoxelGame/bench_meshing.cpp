@@ -0,0 +1,344 @@
+/*
+Headless meshing benchmark. Builds a few deterministic worlds and times face
+culling plus mesh generation (ChunkView::computeUpdates) without a window or
+GL context. Prints a summary and optionally writes JSON for tracking
+regressions.
+
+    bench_meshing [--data DIR] [--storage DIR] [--iterations N] [--lod] [--no-mesh-cache] [--only WORLD] [--json FILE]
+
+--data is the directory holding blocks/ and textures/ (default "."). The
+exit status is 1 if a block type it uses can't be loaded. Chunks are never
+saved; --storage only needs to point somewhere without chunk files.
+Render data is released after each pass as if it had been uploaded, so rss_kb
+is the steady state between passes and peak_kb the high-water mark. Both are
+for the whole process, so use --only to measure one world by itself.
+MeshCache is emptied before every pass, so cache_hit% counts only chunks
+that repeat another chunk in the same world, as during a mass load.
+*/
+
+#include "world.hpp"
+#include "chunkview.hpp"
+#include "occlusion.hpp"
+#include "filelocator.hpp"
+#include "time.hpp"
+#include "alloccount.hpp"
+#include "benchutil.hpp"
+#include "geometry.hpp"
+#include "meshcache.hpp"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+void register_static_blocks();
+void init_dirt_block();
+
+// Scenarios are placed far apart along X so they don't see each other's
+// blocks
+static const int scenario_spacing = 64;
+
+// Resident set size, current and peak, in kilobytes
+static void getRss(size_t& current_kb, size_t& peak_kb)
+{
+    current_kb = peak_kb = 0;
+#ifdef __linux__
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "VmRSS:", 6)) current_kb = strtoul(line + 6, 0, 10);
+        if (!strncmp(line, "VmHWM:", 6)) peak_kb = strtoul(line + 6, 0, 10);
+    }
+    fclose(f);
+#endif
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+        current_kb = info.resident_size / 1024;
+        peak_kb = info.resident_size_max / 1024;
+    }
+#endif
+}
+
+struct Region {
+    BlockPos origin;    // Lowest corner, in blocks
+    int size_x, size_y, size_z;     // In chunks
+    std::vector<Chunk *> chunks;
+
+    Chunk *chunkAt(const BlockPos& pos) {
+        return World::instance.getChunk(pos.getChunkPos(), World::NoLoad);
+    }
+    void gen(int x, int y, int z, const char *name) {
+        BlockPos pos = origin.offset(x, y, z);
+        chunkAt(pos)->genBlock(pos, name);
+    }
+    void set(int x, int y, int z, const char *name, int rotation) {
+        BlockPos pos = origin.offset(x, y, z);
+        chunkAt(pos)->setBlock(pos, name, rotation);
+    }
+};
+
+static void buildFlat(Region& r)
+{
+    for (int y=1; y<12; y++) {
+        for (int z=0; z<r.size_z*16; z++) {
+            for (int x=0; x<r.size_x*16; x++) {
+                r.gen(x, y, z, y < 11 ? "stone" : "dirt");
+            }
+        }
+    }
+}
+
+// Same shell as makeSphere in main.cpp
+static void buildSphere(Region& r)
+{
+    for (int x=-40; x<=40; x++) {
+        for (int y=-30; y<=30; y++) {
+            for (int z=-40; z<=40; z++) {
+                double d = x*x + y*y + z*z;
+                if (d <= 900 && d >= 100) r.gen(x + 48, y + 32, z + 48, "cobblestone");
+            }
+        }
+    }
+}
+
+static void buildNoise(Region& r)
+{
+    static const char *names[] = { "stone", "brick", "wood", "steel" };
+    Random rng(12345);
+    for (int y=1; y<r.size_y*16; y++) {
+        for (int z=0; z<r.size_z*16; z++) {
+            for (int x=0; x<r.size_x*16; x++) {
+                if (rng.range(2)) r.gen(x, y, z, names[rng.range(4)]);
+            }
+        }
+    }
+}
+
+static void buildMixed(Region& r)
+{
+    static const char *names[] = { "stone", "wood_wedge", "wood_slab", "wood_inner_wedge",
+        "wood_outer_wedge", "wood_diag", "numbercube", "transgray", "brick" };
+    const int num_names = sizeof(names) / sizeof(names[0]);
+    Random rng(67890);
+    for (int y=1; y<r.size_y*16; y++) {
+        for (int z=0; z<r.size_z*16; z++) {
+            for (int x=0; x<r.size_x*16; x++) {
+                if (rng.range(5) < 3) r.set(x, y, z, names[rng.range(num_names)], rng.range(24));
+            }
+        }
+    }
+}
+
+// Rolling hills covering the default load radius of 5 chunks
+static void buildTerrain(Region& r)
+{
+    for (int z=0; z<r.size_z*16; z++) {
+        for (int x=0; x<r.size_x*16; x++) {
+            int height = 24 + (int)(8 * sin(x * 0.07) + 6 * cos(z * 0.05) + 4 * sin((x + z) * 0.13));
+            for (int y=1; y<=height; y++) r.gen(x, y, z, y < height ? "stone" : "dirt");
+        }
+    }
+}
+
+// Solid rock with one tunnel running along X through the middle. Used to
+// check occlusion culling as well as meshing.
+static const int cave_y = 40, cave_z = 40;
+
+static void buildCave(Region& r)
+{
+    for (int y=1; y<r.size_y*16; y++) {
+        for (int z=0; z<r.size_z*16; z++) {
+            for (int x=0; x<r.size_x*16; x++) {
+                bool tunnel = y >= cave_y && y < cave_y + 3 && z >= cave_z && z < cave_z + 3;
+                if (!tunnel) r.gen(x, y, z, "stone");
+            }
+        }
+    }
+}
+
+struct Scenario {
+    const char *name;
+    void (*build)(Region& r);
+    int size_x, size_y, size_z;
+};
+
+static const Scenario scenarios[] = {
+    { "flat", buildFlat, 6, 4, 6 },
+    { "sphere", buildSphere, 6, 4, 6 },
+    { "noise", buildNoise, 6, 4, 6 },
+    { "mixed", buildMixed, 6, 4, 6 },
+    { "cave", buildCave, 6, 4, 6 },
+    { "radius5", buildTerrain, 11, 4, 11 },
+};
+
+struct Result {
+    const char *name;
+    size_t chunks;
+    double seconds;
+    size_t vertices, bytes, allocs;
+    int occlusion_visible;
+    size_t rss_kb, rss_peak_kb;
+    size_t cache_hits, cache_misses;
+};
+
+static Result runScenario(int index, int iterations)
+{
+    const Scenario& sc(scenarios[index]);
+    Region r;
+    r.origin = BlockPos(index * scenario_spacing * 16, 0, 0);
+    r.size_x = sc.size_x;
+    r.size_y = sc.size_y;
+    r.size_z = sc.size_z;
+
+    // Loading generates each chunk, which lays down the ground layer
+    ChunkPos base = r.origin.getChunkPos();
+    for (int y=0; y<r.size_y; y++) {
+        for (int z=0; z<r.size_z; z++) {
+            for (int x=0; x<r.size_x; x++) {
+                r.chunks.push_back(World::instance.getChunk(ChunkPos(base.X + x, base.Y + y, base.Z + z)));
+            }
+        }
+    }
+    sc.build(r);
+
+    // Let blocks settle (dirt computes its mesh on repaint)
+    for (Chunk *chunk : r.chunks) chunk->repaintAllBlocks();
+    for (int pass=0; pass<100 && World::instance.doBlockUpdates(); pass++) {}
+
+    BlockPos center = r.origin.offset(r.size_x * 8, r.size_y * 8, r.size_z * 8);
+
+    Result res;
+    memset(&res, 0, sizeof(res));
+    res.name = sc.name;
+    res.chunks = r.chunks.size();
+
+    for (int it=0; it<iterations; it++) {
+        for (Chunk *chunk : r.chunks) chunk->getView()->markChunkUpdated();
+        MeshCache::instance.clear();
+        size_t hits_before = MeshCache::instance.hits, misses_before = MeshCache::instance.misses;
+
+        size_t allocs_before = num_allocs;
+        double start = ref::currentTime();
+        for (Chunk *chunk : r.chunks) chunk->getView()->computeUpdates(center);
+        res.seconds += ref::currentTime() - start;
+        res.allocs += num_allocs - allocs_before;
+        res.cache_hits += MeshCache::instance.hits - hits_before;
+        res.cache_misses += MeshCache::instance.misses - misses_before;
+
+        if (it == iterations-1) {
+            for (Chunk *chunk : r.chunks) chunk->getView()->addMeshStats(res.vertices, res.bytes);
+        }
+
+        // Stand in for the graphics thread uploading everything, which
+        // hands the buffers back for the next pass to reuse
+        for (Chunk *chunk : r.chunks) chunk->getView()->releaseRenderData();
+        RenderManager::instance.deleteDeadRendererQueue();
+    }
+
+    getRss(res.rss_kb, res.rss_peak_kb);
+
+    // Standing in the tunnel, with nothing frustum culled
+    OcclusionCuller culler;
+    std::vector<Chunk *> visible;
+    BlockPos camera = r.origin.offset(r.size_x * 8, cave_y + 1, cave_z + 1);
+    culler.cull(r.chunks, r.chunks, camera.getChunkPos(), visible);
+    res.occlusion_visible = (int)visible.size();
+
+    return res;
+}
+
+static double hitRate(const Result& r)
+{
+    size_t total = r.cache_hits + r.cache_misses;
+    return total ? (double)r.cache_hits / total : 0;
+}
+
+static void writeJson(FILE *f, const std::vector<Result>& results, int iterations)
+{
+    fprintf(f, "{\n  \"benchmark\": \"meshing\",\n  \"iterations\": %d,\n  \"scenarios\": [\n", iterations);
+    for (size_t i=0; i<results.size(); i++) {
+        const Result& r(results[i]);
+        double n = (double)r.chunks;
+        fprintf(f, "    {\"name\": \"%s\", \"chunks\": %zu, \"seconds\": %.6f, \"chunks_per_sec\": %.1f, "
+                   "\"vertices_per_chunk\": %.1f, \"bytes_per_chunk\": %.1f, \"allocs_per_chunk\": %.2f, "
+                   "\"occlusion_visible\": %d, \"rss_kb\": %zu, \"rss_peak_kb\": %zu, \"mesh_cache_hit_rate\": %.3f}%s\n",
+            r.name, r.chunks, r.seconds, n * iterations / r.seconds,
+            r.vertices / n, r.bytes / n, r.allocs / (n * iterations),
+            r.occlusion_visible, r.rss_kb, r.rss_peak_kb, hitRate(r), i+1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *json_file = 0;
+    const char *only = 0;
+    const char *storage_dir = "bench_storage";
+    int iterations = 5;
+    bool use_lod = false;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--data") && i+1 < argc) {
+            FileLocator::instance.setConfigDir(argv[++i]);
+        } else if (!strcmp(argv[i], "--storage") && i+1 < argc) {
+            storage_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--iterations") && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json") && i+1 < argc) {
+            json_file = argv[++i];
+        } else if (!strcmp(argv[i], "--only") && i+1 < argc) {
+            only = argv[++i];
+        } else if (!strcmp(argv[i], "--lod")) {
+            use_lod = true;
+        } else if (!strcmp(argv[i], "--no-mesh-cache")) {
+            MeshCache::instance.enabled = false;
+        } else {
+            fprintf(stderr, "usage: %s [--data DIR] [--storage DIR] [--iterations N] [--lod] [--no-mesh-cache] [--only WORLD] [--json FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+    FileLocator::instance.setStorageDir(storage_dir);
+
+    if (!use_lod) {
+        for (int i=1; i<ChunkView::NUM_LOD; i++) ChunkView::lod_distance[i] = 1e30;
+    }
+
+    register_static_blocks();
+    init_dirt_block();
+    if (!haveBlockTypes({ "stone", "dirt", "cobblestone", "brick", "wood", "steel", "wood_wedge", "wood_slab",
+        "wood_inner_wedge", "wood_outer_wedge", "wood_diag", "numbercube", "transgray" })) return 1;
+
+    std::vector<Result> results;
+    for (int i=0; i<(int)(sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+        if (only && strcmp(only, scenarios[i].name)) continue;
+        results.push_back(runScenario(i, iterations));
+    }
+
+    printf("\n%-8s %7s %12s %12s %12s %12s %8s %10s %10s %10s\n", "world", "chunks", "chunks/s", "verts/chunk", "bytes/chunk",
+        "allocs/chunk", "visible", "rss_kb", "peak_kb", "cache_hit%");
+    for (const Result& r : results) {
+        double n = (double)r.chunks;
+        printf("%-8s %7zu %12.1f %12.1f %12.1f %12.2f %8d %10zu %10zu %10.1f\n", r.name, r.chunks,
+            n * iterations / r.seconds, r.vertices / n, r.bytes / n, r.allocs / (n * iterations),
+            r.occlusion_visible, r.rss_kb, r.rss_peak_kb, hitRate(r) * 100);
+    }
+
+    if (json_file) {
+        FILE *f = fopen(json_file, "w");
+        if (!f) {
+            fprintf(stderr, "Unable to write %s\n", json_file);
+            return 1;
+        }
+        writeJson(f, results, iterations);
+        fclose(f);
+    }
+
+    return 0;
+}
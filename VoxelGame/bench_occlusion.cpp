@@ -0,0 +1,114 @@
+/*
+Headless OcclusionCuller benchmark. Builds a 9x9x9 block of chunks with
+the camera in the middle, computes each chunk's face connectivity the way
+remeshing does, then times culling from the center. Exits with status 1 if
+a scene doesn't show the chunks it should:
+
+    open        every chunk empty, so all 729 are visible
+    tunnel      solid stone with one straight tunnel along X through the
+                camera's row: the 9 tunnel chunks and the camera chunk's 4
+                other neighbors
+    solid       solid stone: the camera chunk and its 6 neighbors
+
+    bench_occlusion [--data DIR] [--iterations N]
+
+--data is the directory holding blocks/ and textures/ (default "."), needed
+for block types. The exit status is 1 if one it uses can't be loaded.
+*/
+
+#include "chunk.hpp"
+#include "chunkview.hpp"
+#include "occlusion.hpp"
+#include "filelocator.hpp"
+#include "time.hpp"
+#include "benchutil.hpp"
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void register_static_blocks();
+void init_dirt_block();
+
+static const int radius = 4;
+
+struct Scenario {
+    const char *name;
+    bool solid;
+    bool tunnel;
+    size_t expect_visible;
+};
+
+static const Scenario scenarios[] = {
+    { "open", false, false, 729 },
+    { "tunnel", true, true, 13 },
+    { "solid", true, false, 7 },
+};
+
+// Chunks are made once per scenario at a different Y, and never freed
+static bool runScenario(int index, int iterations)
+{
+    const Scenario& sc(scenarios[index]);
+    int base_y = index * (2 * radius + 4);
+    ChunkPos camera(0, base_y, 0);
+
+    std::vector<Chunk *> all;
+    for (int x=-radius; x<=radius; x++) {
+        for (int y=-radius; y<=radius; y++) {
+            for (int z=-radius; z<=radius; z++) {
+                Chunk *c = new Chunk(ChunkPos(x, base_y + y, z));
+                BlockPos corner = BlockPos::getBlockPos(c->getChunkPos());
+                bool in_tunnel = sc.tunnel && y == 0 && z == 0;
+                for (int i=0; sc.solid && i<sizes::chunk_storage_size; i++) {
+                    BlockPos pos = c->decodeIndex(i);
+                    if (in_tunnel && pos.Y - corner.Y == 8 && pos.Z - corner.Z == 8) continue;
+                    c->genBlock(pos, "stone");
+                }
+                all.push_back(c);
+            }
+        }
+    }
+
+    double start = ref::currentTime();
+    for (Chunk *c : all) c->getView()->updateConnectivity();
+    double connect_seconds = ref::currentTime() - start;
+
+    OcclusionCuller culler;
+    std::vector<Chunk *> visible;
+    start = ref::currentTime();
+    for (int it=0; it<iterations; it++) culler.cull(all, all, camera, visible);
+    double cull_seconds = ref::currentTime() - start;
+
+    bool ok = visible.size() == sc.expect_visible;
+    printf("%-8s %7zu %14.2f %10.2f %8zu %8zu%s\n", sc.name, all.size(), connect_seconds * 1e6 / all.size(),
+        cull_seconds * 1e6 / iterations, visible.size(), sc.expect_visible, ok ? "" : "  FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 1000;
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--data") && i+1 < argc) {
+            FileLocator::instance.setConfigDir(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--data DIR] [--iterations N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+
+    register_static_blocks();
+    init_dirt_block();
+    if (!haveBlockTypes({ "stone" })) return 1;
+
+    bool ok = true;
+    printf("\n%-8s %7s %14s %10s %8s %8s\n", "scene", "chunks", "connect us/ch", "cull us", "visible", "expected");
+    for (int i=0; i<(int)(sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+        if (!runScenario(i, iterations)) ok = false;
+    }
+    printf("%s\n", ok ? "occlusion OK" : "occlusion FAILED");
+    return ok ? 0 : 1;
+}
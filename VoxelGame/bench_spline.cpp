@@ -0,0 +1,166 @@
+/*
+Spline2D benchmark. Times evaluating whole height grids the way dirt blocks
+do, point by point with Spline2D::compute and in one call with
+Spline2D::compute_grid, and checks that the two agree where it matters:
+heights quantized to 1/128 as in DirtShape. Exits with status 1 if any
+quantized height is off by more than one step, or if more than a few are
+off at all. The largest raw difference is reported but not checked, since
+the square root in the blend magnifies float rounding near zero.
+
+    bench_spline [--grids N] [--iterations N] [--json FILE]
+
+Grids are random but deterministic. "dirt" uses the corner, edge and slope
+values DynamicDirtBlock::repaintEvent picks from; "random" uses arbitrary
+values in [-1, 2] for coverage of the clamping.
+*/
+
+#include "spline.hpp"
+#include "time.hpp"
+#include <vector>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static void randomSpline(Spline2D& s, std::minstd_rand& rng, bool dirt)
+{
+    static const double heights[] = { 0, 0.8, 1 };
+    static const double slopes[] = { -1, 0, 1 };
+    double *z[] = { &s.z00, &s.z10, &s.z20, &s.z01, &s.z11, &s.z21, &s.z02, &s.z12, &s.z22 };
+    double *v[] = { &s.vx0dy0, &s.vx1dy0, &s.vx2dy0, &s.vx0dy2, &s.vx1dy2, &s.vx2dy2,
+                    &s.vy0dx0, &s.vy1dx0, &s.vy2dx0, &s.vy0dx2, &s.vy1dx2, &s.vy2dx2 };
+    std::uniform_real_distribution<double> any(-1, 2);
+    for (double *p : z) *p = dirt ? heights[rng() % 3] : any(rng);
+    for (double *p : v) *p = dirt ? slopes[rng() % 3] : any(rng);
+    if (dirt) s.z11 = 0.8;
+    s.compute_coefficients();
+}
+
+struct Result {
+    const char *name;
+    int size;
+    size_t grids;
+    double scalar_seconds, grid_seconds;
+    double max_error;
+    size_t quantized_diffs;
+    int max_quantized_diff;
+};
+
+static Result runCase(const char *name, bool dirt, int n, int num_grids, int iterations)
+{
+    std::minstd_rand rng(12345);
+    std::vector<Spline2D> splines(num_grids);
+    for (Spline2D& s : splines) randomSpline(s, rng, dirt);
+
+    SplineGrid grid(n);
+    std::vector<double> scalar((size_t)num_grids * n * n);
+    std::vector<float> batched((size_t)num_grids * n * grid.stride);
+
+    Result res;
+    memset(&res, 0, sizeof(res));
+    res.name = name;
+    res.size = n;
+    res.grids = (size_t)num_grids * iterations;
+
+    double frac = 1.0 / (n-1);
+    for (int it=0; it<iterations; it++) {
+        double start = ref::currentTime();
+        for (int g=0; g<num_grids; g++) {
+            double *out = &scalar[(size_t)g * n * n];
+            for (int j=0; j<n; j++) {
+                for (int i=0; i<n; i++) {
+                    out[j*n + i] = splines[g].compute(i * frac, j * frac);
+                }
+            }
+        }
+        res.scalar_seconds += ref::currentTime() - start;
+
+        start = ref::currentTime();
+        for (int g=0; g<num_grids; g++) {
+            splines[g].compute_grid(grid, &batched[(size_t)g * n * grid.stride]);
+        }
+        res.grid_seconds += ref::currentTime() - start;
+    }
+
+    for (int g=0; g<num_grids; g++) {
+        const double *a = &scalar[(size_t)g * n * n];
+        const float *b = &batched[(size_t)g * n * grid.stride];
+        for (int j=0; j<n; j++) {
+            for (int i=0; i<n; i++) {
+                double x = a[j*n + i], y = b[j*grid.stride + i];
+                res.max_error = std::max(res.max_error, fabs(x - y));
+                int diff = abs((int)round(x * 128) - (int)round(y * 128));
+                if (diff) res.quantized_diffs++;
+                res.max_quantized_diff = std::max(res.max_quantized_diff, diff);
+            }
+        }
+    }
+    return res;
+}
+
+static void writeJson(FILE *f, const std::vector<Result>& results)
+{
+    fprintf(f, "{\n  \"benchmark\": \"spline\",\n  \"cases\": [\n");
+    for (size_t i=0; i<results.size(); i++) {
+        const Result& r(results[i]);
+        fprintf(f, "    {\"name\": \"%s\", \"size\": %d, \"grids\": %zu, \"scalar_ns_per_grid\": %.1f, "
+                   "\"grid_ns_per_grid\": %.1f, \"speedup\": %.2f, \"max_error\": %.3g, \"quantized_diffs\": %zu, "
+                   "\"max_quantized_diff\": %d}%s\n",
+            r.name, r.size, r.grids, r.scalar_seconds * 1e9 / r.grids, r.grid_seconds * 1e9 / r.grids,
+            r.scalar_seconds / r.grid_seconds, r.max_error, r.quantized_diffs, r.max_quantized_diff, i+1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *json_file = 0;
+    int num_grids = 4096, iterations = 10;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--grids") && i+1 < argc) {
+            num_grids = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json") && i+1 < argc) {
+            json_file = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--grids N] [--iterations N] [--json FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_grids < 1) num_grids = 1;
+    if (iterations < 1) iterations = 1;
+
+    std::vector<Result> results;
+    results.push_back(runCase("dirt", true, 17, num_grids, iterations));
+    results.push_back(runCase("random", false, 17, num_grids, iterations));
+    results.push_back(runCase("dirt", true, 9, num_grids, iterations));
+    results.push_back(runCase("random", false, SplineGrid::max_size, num_grids, iterations));
+
+    bool ok = true;
+    printf("\n%-8s %5s %9s %12s %12s %8s %11s %10s %9s\n", "case", "size", "grids", "scalar ns", "grid ns",
+        "speedup", "max error", "quant diff", "max steps");
+    for (const Result& r : results) {
+        printf("%-8s %5d %9zu %12.1f %12.1f %8.2f %11.3g %10zu %9d\n", r.name, r.size, r.grids,
+            r.scalar_seconds * 1e9 / r.grids, r.grid_seconds * 1e9 / r.grids,
+            r.scalar_seconds / r.grid_seconds, r.max_error, r.quantized_diffs, r.max_quantized_diff);
+        // Values landing right on a rounding boundary can go either way in
+        // float; more than a handful means something is actually wrong
+        size_t samples = (size_t)num_grids * r.size * r.size;
+        if (r.max_quantized_diff > 1 || r.quantized_diffs > samples / 10000) ok = false;
+    }
+    printf("%s\n", ok ? "accuracy OK" : "accuracy FAILED");
+
+    if (json_file) {
+        FILE *f = fopen(json_file, "w");
+        if (!f) {
+            fprintf(stderr, "Unable to write %s\n", json_file);
+            return 1;
+        }
+        writeJson(f, results);
+        fclose(f);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#ifndef INCLUDED_BENCH_UTIL_HPP
+#define INCLUDED_BENCH_UTIL_HPP
+
+#include "blocklibrary.hpp"
+#include <initializer_list>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+Pieces the bench_ programs share, so their fixtures stay in step.
+*/
+
+// xorshift, so worlds are the same on every platform
+struct Random {
+    uint32_t state;
+    Random(uint32_t seed) : state(seed) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    int range(int n) { return next() % n; }
+};
+
+// After registering blocks, so a bench can't pass without the ones it
+// builds with. Says which are missing.
+inline bool haveBlockTypes(std::initializer_list<const char *> names)
+{
+    bool ok = true;
+    for (const char *name : names) {
+        if (BlockLibrary::instance.getBlockType(name)) continue;
+        fprintf(stderr, "Block type %s isn't registered; check --data\n", name);
+        ok = false;
+    }
+    return ok;
+}
+
+#endif
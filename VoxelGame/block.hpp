@@ -79,6 +79,10 @@ struct Block {
     DataContainerPtr getData(bool create) { return chunk->getDataContainer(this, create); }
     void setData(DataContainerPtr data) { chunk->setDataContainer(this, data); }
     
+    // Get surface heights from chunk, creating them (zeroed) if asked
+    HeightField *getHeights(bool create) { return chunk->getHeightField(this, create); }
+    void clearHeights() { chunk->clearHeightField(this); }
+    
     // Turn block into data. This is not for disk storage but for moving blocks around.
     // Caller must clear deque
     // void serialize(deque<char> bytes);
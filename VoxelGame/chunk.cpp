@@ -3,8 +3,10 @@
 #include "blocklibrary.hpp"
 #include "chunkview.hpp"
 #include <iostream>
-#include "filelocator.hpp"
-#include <fstream>
+#include "regionfile.hpp"
+#include "chunkcodec.hpp"
+#include "editjournal.hpp"
+#include "savequeue.hpp"
 #include "time.hpp"
 #include "world.hpp"
 #include <atomic>
@@ -22,6 +24,8 @@ Chunk::Chunk(ChunkPos p)
     memset(block_rotation, 0, sizeof(block_rotation));
     
     needs_save = false;
+    journaled = false;
+    journal_record = 0;
     last_save = ref::currentTime();
     time_unloaded = 0;
     
@@ -107,6 +111,7 @@ void Chunk::setBlock(const BlockPos& pos, const std::string& name, int rotation)
     block_rotation[index] = rotation;
     // visible_faces[index] = 0;
     data_containers.erase(index);
+    height_fields.erase(index);
     std::atomic_store(&meshes[index], MeshPtr(0));
     // meshes[index].reset();
 
@@ -121,7 +126,30 @@ void Chunk::setBlock(const BlockPos& pos, const std::string& name, int rotation)
     }
     
     std::cout << "Marking block needing save\n";
+    // Marked before journaling, so a checkpoint that starts in between still
+    // saves the chunk. If the events didn't change anything else, the chunk
+    // can then wait.
+    bool was_saved = !needs_save;
     needs_save = true;
+    if (uint64_t record = EditJournal::instance.recordBlock(pos, name, rotation)) {
+        journal_record = record;
+        if (was_saved) journaled = true;
+    } else {
+        journaled = false;
+    }
+}
+
+void Chunk::replayBlock(const BlockPos& pos, const std::string& name, int rotation, uint64_t record)
+{
+    uint16_t index = chunkBlockIndex(pos);
+    block_storage[index] = getBlockID(name);
+    block_rotation[index] = rotation;
+    data_containers.erase(index);
+    height_fields.erase(index);
+    std::atomic_store(&meshes[index], MeshPtr(0));
+    needs_save = true;
+    journaled = false;
+    journal_record = record;
 }
 
 void Chunk::genBlock(const BlockPos& pos, const std::string& name)
@@ -130,6 +158,7 @@ void Chunk::genBlock(const BlockPos& pos, const std::string& name)
     uint16_t block_id = getBlockID(name);
     block_storage[index] = block_id;
     needs_save = true;
+    journaled = false;
 }
 
 void Chunk::requestVisualUpdate(Block *block)
@@ -208,6 +237,7 @@ void Chunk::setRotation(Block *block, int rot)
     block_rotation[block->storage_index] = rot;
     requestVisualUpdate(block);
     needs_save = true;
+    journaled = false;
 }
 
 
@@ -248,6 +278,21 @@ void Chunk::setDataContainer(Block *block, DataContainerPtr data)
     }
 }
 
+HeightField *Chunk::getHeightField(Block *block, bool create)
+{
+    auto i = height_fields.find(block->storage_index);
+    if (i != height_fields.end()) return &i->second;
+    if (!create) return 0;
+    HeightField& field(height_fields[block->storage_index]);
+    memset(field.code, 0, sizeof(field.code));
+    return &field;
+}
+
+void Chunk::clearHeightField(Block *block)
+{
+    height_fields.erase(block->storage_index);
+}
+
 void Chunk::getCorners(BlockPos *bpos, const BlockPos& center)
 {
     BlockPos a = BlockPos::getBlockPos(chunk_pos);
@@ -272,109 +317,271 @@ ChunkView* Chunk::getView()
 }
 
 
-// XXX either use spinlock on chunk while serializing, or have main thread serialize
+// XXX either use spinlock on chunk while copying, or have main thread do it
+void Chunk::snapshot(ChunkSnapshot& snap)
+{
+    needs_save = false;
+    journaled = false;
+    last_save = ref::currentTime();
+    
+    snap.chunk_pos = chunk_pos;
+    memcpy(snap.block_storage, block_storage, sizeof(block_storage));
+    memcpy(snap.block_rotation, block_rotation, sizeof(block_rotation));
+    snap.ids.assign(name2index.begin(), name2index.end());
+    snap.containers.clear();
+    snap.container_bytes.clear();
+    for (auto i=data_containers.begin(); i!=data_containers.end(); ++i) {
+        if (!i->second) continue;
+        i->second->pack(snap.container_bytes);
+        snap.containers.emplace_back(i->first, snap.container_bytes.size());
+    }
+    snap.height_fields.assign(height_fields.begin(), height_fields.end());
+    snap.journal_record = journal_record;
+    
+    // MeshPtr meshes[sizes::chunk_storage_size];
+}
+
 void Chunk::save()
 {
     if (!needs_save) return;
-    needs_save = false;
     
-    DataContainerPtr data = DataContainer::makeContainer();
+    static thread_local ChunkSnapshot snap;
+    static thread_local ByteWriter stored;
+    snapshot(snap);
+    stored.clear();
+    snap.serialize(stored);
     
-    // name/id mapping
-    // std::unordered_map<std::string, uint16_t> name2index;
-    DataContainerPtr ids = DataContainer::makeContainer();
-    data->setNamedItem("ids", DataItem::wrapContainer(ids));
-    for (auto i=name2index.begin(); i!=name2index.end(); ++i) {
-        ids->setNamedItem(i->first, DataItem::makeInt16(i->second));
+    // std::cout << "Saving chunk " << chunk_pos.toString() << std::endl;
+    RegionStore::instance.writeChunk(chunk_pos, stored.data(), stored.size());
+}
+
+// Dirt comes in a handful of shapes, so most height fields in a chunk
+// repeat one another. Numbers each field by the first with the same
+// heights, and lists those firsts in order.
+static void findHeightShapes(const std::vector<std::pair<uint16_t, HeightField>>& fields,
+    std::vector<uint16_t>& shape_of, std::vector<const HeightField *>& shapes)
+{
+    static thread_local std::vector<int> slots;
+    size_t num_slots = 16;
+    while (num_slots < fields.size() * 2) num_slots *= 2;
+    slots.assign(num_slots, -1);
+    shape_of.clear();
+    shapes.clear();
+    for (auto i=fields.begin(); i!=fields.end(); ++i) {
+        const uint8_t *code = i->second.code;
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t j=0; j<sizeof(i->second.code); j++) hash = (hash ^ code[j]) * 1099511628211ull;
+        size_t slot = hash & (num_slots - 1);
+        while (slots[slot] >= 0 && memcmp(shapes[slots[slot]]->code, code, sizeof(i->second.code))) {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        if (slots[slot] < 0) {
+            slots[slot] = (int)shapes.size();
+            shapes.push_back(&i->second);
+        }
+        shape_of.push_back((uint16_t)slots[slot]);
     }
+}
+
+// The container tree only lives long enough to be packed, so it's built in
+// an arena that's reset for the next chunk instead of out of heap items.
+void ChunkSnapshot::serialize(ByteWriter& out) const
+{
+    static thread_local MemoryArena arena;
+    arena.reset();
+    ArenaContainer data(arena);
     
-    // block storage
-    // uint16_t block_storage[sizes::chunk_storage_size];
-    data->setNamedItem("blocks", DataItem::makeInt16Array(sizes::chunk_storage_size, (const int16_t*)block_storage));
+    // name/id mapping
+    ArenaItem *ids_item = data.addContainer();
+    ids_item->setName("ids");
+    for (auto i=ids.begin(); i!=ids.end(); ++i) {
+        ids_item->container->addInt16(i->second)->setName(i->first);
+    }
     
-    // block rotation
-    // uint8_t block_rotation[sizes::chunk_storage_size];
-    data->setNamedItem("rotation", DataItem::makeInt8Array(sizes::chunk_storage_size, (const int8_t*)block_rotation));
+    // block storage and rotation, either as they are or as cell arrays
+    if (ChunkCodec::instance.palette) {
+        static thread_local ByteWriter cells;
+        cells.clear();
+        ChunkCodec::encodeCells(block_storage, sizes::chunk_storage_size, cells);
+        data.addInt8Array(cells.size(), (const int8_t*)cells.data())->setName("block_cells");
+        cells.clear();
+        ChunkCodec::encodeCells(block_rotation, sizes::chunk_storage_size, cells);
+        data.addInt8Array(cells.size(), (const int8_t*)cells.data())->setName("rotation_cells");
+    } else {
+        data.addInt16Array(sizes::chunk_storage_size, (const int16_t*)block_storage)->setName("blocks");
+        data.addInt8Array(sizes::chunk_storage_size, (const int8_t*)block_rotation)->setName("rotation");
+    }
     
     // Data containers
-    // std::unordered_map<uint16_t, DataContainerPtr> data_containers;
-    DataContainerPtr ctrs = DataContainer::makeContainer();
-    data->setNamedItem("data", DataItem::wrapContainer(ctrs));
-    for (auto i=data_containers.begin(); i!=data_containers.end(); ++i) {
-        if (i->second) {
-            ctrs->setIndexedItem(i->first, DataItem::wrapContainer(i->second));
-        }
+    ArenaItem *ctrs_item = data.addContainer();
+    ctrs_item->setName("data");
+    size_t start = 0;
+    for (auto i=containers.begin(); i!=containers.end(); ++i) {
+        ctrs_item->container->addContainer(container_bytes.data() + start, i->second - start)->setIndex(i->first);
+        start = i->second;
     }
     
-    // data->debug();
-    std::deque<char> serial;
-    data->pack(serial);
-    
-    std::string chunk_name = chunk_pos.toString();
-    std::string fname = FileLocator::instance.chunk(chunk_name);
-    std::cout << "Saving chunk " << fname << std::endl;
-    std::ofstream wf(fname, std::ios::binary);
-    std::copy(serial.begin(), serial.end(), std::ostreambuf_iterator<char>(wf));
-    wf.close();
+    // Height fields, as an array of block indices, the distinct heights
+    // back to back, and which of those each block has
+    if (!height_fields.empty()) {
+        const size_t field_bytes = sizeof(HeightField::code);
+        static thread_local std::vector<uint16_t> shape_of;
+        static thread_local std::vector<const HeightField *> shapes;
+        findHeightShapes(height_fields, shape_of, shapes);
+        ArenaItem *index_item = data.addInt16Array(height_fields.size());
+        ArenaItem *shape_item = data.addInt16Array(height_fields.size(), (const int16_t*)shape_of.data());
+        ArenaItem *heights_item = data.addInt8Array(shapes.size() * field_bytes);
+        index_item->setName("height_index");
+        shape_item->setName("height_shapes");
+        heights_item->setName("heights");
+        int16_t *index_ptr = index_item->getInt16Array();
+        for (auto i=height_fields.begin(); i!=height_fields.end(); ++i) *index_ptr++ = i->first;
+        int8_t *heights_ptr = heights_item->getInt8Array();
+        for (const HeightField *f : shapes) {
+            memcpy(heights_ptr, f->code, field_bytes);
+            heights_ptr += field_bytes;
+        }
+    }
     
-    last_save = ref::currentTime();
+    if (journal_record) data.addInt64(journal_record)->setName("journal_record");
     
-    // MeshPtr meshes[sizes::chunk_storage_size];
+    static thread_local ByteWriter serial;
+    serial.clear();
+    data.pack(serial);
+    ChunkCodec::instance.encode(serial.data(), serial.size(), out);
 }
 
+// Decodes straight out of the read buffer. Only the block data containers
+// are unpacked into items of their own.
 bool Chunk::load()
 {
-    std::string chunk_name = chunk_pos.toString();
-    std::string fname = FileLocator::instance.chunk(chunk_name);
-    // std::cout << "Loading chunk " << fname << std::endl;
-    
-    std::ifstream rf(fname, std::ios::binary);
-    if (!rf.good()) return false;
-    std::deque<char> serial;
-    serial.assign(std::istreambuf_iterator<char>(rf), std::istreambuf_iterator<char>());
-    rf.close();
-    
-    // std::cout << serial.size() << " bytes\n";
-    // DataContainerPtr data = DataContainer::makeContainer();
-    // data->unpack(serial);
-    DataContainerPtr data = DataContainer::unpack(serial);
-    // data->debug();
+    // std::cout << "Loading chunk " << chunk_pos.toString() << std::endl;
+    
+    // A save still on its way to disk would be missed
+    SaveQueue::instance.waitFor(chunk_pos);
+    
+    static thread_local std::vector<char> bytes, unpacked;
+    if (!RegionStore::instance.readChunk(chunk_pos, bytes)) return false;
+    
+    // std::cout << bytes.size() << " bytes\n";
+    const char *packed = bytes.data();
+    size_t packed_length = bytes.size();
+    if (!ChunkCodec::decode(packed, packed_length, unpacked)) {
+        std::cout << "Unable to decode chunk " << chunk_pos.toString() << std::endl;
+        return false;
+    }
+    
+    ByteReader serial(packed, packed_length);
+    DataItemView item, ids, blocks, rot, block_cells, rot_cells, ctrs, index_item, shape_item, heights_item, record_item;
+    while (DataItemView::next(serial, item)) {
+        if (item.name == "ids") {
+            ids = item;
+        } else if (item.name == "blocks") {
+            blocks = item;
+        } else if (item.name == "rotation") {
+            rot = item;
+        } else if (item.name == "block_cells") {
+            block_cells = item;
+        } else if (item.name == "rotation_cells") {
+            rot_cells = item;
+        } else if (item.name == "data") {
+            ctrs = item;
+        } else if (item.name == "height_index") {
+            index_item = item;
+        } else if (item.name == "height_shapes") {
+            shape_item = item;
+        } else if (item.name == "heights") {
+            heights_item = item;
+        } else if (item.name == "journal_record") {
+            record_item = item;
+        }
+    }
+    
+    bool ok = serial.ok() && ids.type == DataItem::CONTAINER;
+    
+    // block storage
+    // uint16_t block_storage[sizes::chunk_storage_size];
+    if (ok && blocks.type == DataItem::INT16 && blocks.array_count == sizes::chunk_storage_size) {
+        memcpy(block_storage, blocks.data, sizeof(block_storage));
+    } else if (ok && block_cells.type == DataItem::INT8) {
+        ok = ChunkCodec::decodeCells(block_cells.data, block_cells.byte_count, block_storage, sizes::chunk_storage_size);
+    } else {
+        ok = false;
+    }
+    
+    // block rotation
+    // uint8_t block_rotation[sizes::chunk_storage_size];
+    if (ok && rot.type == DataItem::INT8 && rot.array_count == sizes::chunk_storage_size) {
+        memcpy(block_rotation, rot.data, sizeof(block_rotation));
+    } else if (ok && rot_cells.type == DataItem::INT8) {
+        ok = ChunkCodec::decodeCells(rot_cells.data, rot_cells.byte_count, block_rotation, sizes::chunk_storage_size);
+    } else {
+        ok = false;
+    }
+    
+    if (!ok) {
+        std::cout << "Corrupt chunk " << chunk_pos.toString() << std::endl;
+        memset(block_storage, 0, sizeof(block_storage));
+        memset(block_rotation, 0, sizeof(block_rotation));
+        return false;
+    }
     
     // name/id mapping
     // std::unordered_map<std::string, uint16_t> name2index;
-    DataContainerPtr ids = data->getNamedItem("ids")->getContainer();
     name2index.clear();
     index2name.clear();
-    for (int i=0; i<ids->numItems(); i++) {
-        DataItemPtr a = ids->getItem(i);
-        const std::string& name(a->getName());
-        uint16_t id = a->getInt16();
-        name2index[name] = id;
+    ByteReader ids_reader = ids.contents();
+    while (DataItemView::next(ids_reader, item)) {
+        std::string name(item.name);
+        uint16_t id = item.getInt16();
         BlockType *bt = BlockLibrary::instance.getBlockType(name);
+        name2index[name] = id;
         if (id >= index2name.size()) index2name.resize(id+1);
         index2name[id] = bt;
     }
     
-    // block storage
-    // uint16_t block_storage[sizes::chunk_storage_size];
-    DataItemPtr blocks = data->getNamedItem("blocks");
-    uint16_t* blocks_ptr = (uint16_t*)(blocks->getInt16Array());
-    // std::cout << "Blocks array count=" << blocks->getArrayCount() << std::endl;
-    memcpy(block_storage, blocks_ptr, sizes::chunk_storage_size * sizeof(uint16_t));
-    
-    // block rotation
-    // uint8_t block_rotation[sizes::chunk_storage_size];
-    DataItemPtr rot = data->getNamedItem("rotation");
-    uint8_t* rot_ptr = (uint8_t*)(rot->getInt8Array());
-    memcpy(block_rotation, rot_ptr, sizes::chunk_storage_size);
-    
     // Data containers
     // std::unordered_map<uint16_t, DataContainerPtr> data_containers;
-    DataContainerPtr ctrs = data->getNamedItem("data")->getContainer();
     data_containers.clear();
-    for (int i=0; i<ctrs->numItems(); i++) {
-        DataItemPtr a = ctrs->getItem(i);
-        data_containers[(uint16_t)a->getIndex()] = a->getContainer();
+    if (ctrs.type == DataItem::CONTAINER) {
+        ByteReader ctrs_reader = ctrs.contents();
+        while (DataItemView::next(ctrs_reader, item)) {
+            if (item.type != DataItem::CONTAINER) continue;
+            ByteReader contents = item.contents();
+            data_containers[(uint16_t)item.index] = DataContainer::unpack(contents);
+        }
+    }
+    
+    // Height fields
+    // std::unordered_map<uint16_t, HeightField> height_fields;
+    height_fields.clear();
+    const size_t field_bytes = sizeof(HeightField::code);
+    size_t num_shapes = heights_item.type == DataItem::INT8 ? heights_item.array_count / field_bytes : 0;
+    if (index_item.type == DataItem::INT16 && shape_item.type == DataItem::INT16 &&
+        shape_item.array_count == index_item.array_count && heights_item.array_count == num_shapes * field_bytes) {
+        height_fields.reserve(index_item.array_count);
+        for (size_t i=0; i<index_item.array_count; i++) {
+            int16_t index, shape;
+            memcpy(&index, index_item.data + i * sizeof(int16_t), sizeof(int16_t));
+            memcpy(&shape, shape_item.data + i * sizeof(int16_t), sizeof(int16_t));
+            if ((uint16_t)shape >= num_shapes) continue;
+            memcpy(height_fields[(uint16_t)index].code, heights_item.data + (uint16_t)shape * field_bytes, field_bytes);
+        }
+    } else if (index_item.type == DataItem::INT16 && heights_item.type == DataItem::INT8 &&
+        heights_item.array_count == index_item.array_count * field_bytes) {
+        // Saved before height_shapes, one field per block
+        height_fields.reserve(index_item.array_count);
+        for (size_t i=0; i<index_item.array_count; i++) {
+            int16_t index;
+            memcpy(&index, index_item.data + i * sizeof(int16_t), sizeof(int16_t));
+            memcpy(height_fields[(uint16_t)index].code, heights_item.data + i * field_bytes, field_bytes);
+        }
+    }
+    migrateHeightFields();
+    
+    journal_record = 0;
+    if (record_item.type == DataItem::INT64 && record_item.byte_count == sizeof(journal_record)) {
+        memcpy(&journal_record, record_item.data, sizeof(journal_record));
     }
     
     last_save = ref::currentTime();
@@ -382,6 +589,33 @@ bool Chunk::load()
     return true;
 }
 
+// Older saves kept dirt heights as a float array in each block's data
+// container. Move them into height_fields and drop containers left empty.
+void Chunk::migrateHeightFields()
+{
+    const int num_heights = HeightField::size * HeightField::size;
+    for (auto i=data_containers.begin(); i!=data_containers.end(); ) {
+        DataItemPtr item = i->second ? i->second->getNamedItem("heights") : DataItemPtr();
+        if (!item || item->getDataType() != DataItem::FLOAT || item->getArrayCount() != num_heights) {
+            ++i;
+            continue;
+        }
+        
+        const float *old_heights = item->getFloatArray();
+        HeightField& field(height_fields[i->first]);
+        for (int j=0; j<num_heights; j++) field.code[j] = HeightField::encode((int)round(old_heights[j] * 128));
+        needs_save = true;
+        journaled = false;
+        
+        i->second->removeNamedItem("heights");
+        if (i->second->numItems() == 0) {
+            i = data_containers.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
 void Chunk::generate()
 {
     if (chunk_pos.Y != 0) return;
@@ -13,15 +13,54 @@
 
 class ChunkView;
 
+// Surface heights for a block with a procedural top (see DynamicDirtBlock),
+// sampled on a 17x17 grid in 1/128ths of a block. Stored biased so that
+// splines overshooting a little below 0 or above 1 still fit in a byte.
+struct HeightField {
+    static constexpr int size = 17;
+    static constexpr int bias = 64;
+    uint8_t code[size * size];
+    
+    static uint8_t encode(int q) {
+        q += bias;
+        return q < 0 ? 0 : (q > 255 ? 255 : q);
+    }
+    static int decode(uint8_t c) { return c - bias; }
+};
+
 struct Block;
 typedef std::shared_ptr<Block> BlockPtr;
 
+// What Chunk::save writes, copied out quickly so it can be serialized on
+// another thread (see SaveQueue)
+struct ChunkSnapshot {
+    ChunkPos chunk_pos;
+    uint16_t block_storage[sizes::chunk_storage_size];
+    uint8_t block_rotation[sizes::chunk_storage_size];
+    std::vector<std::pair<std::string, uint16_t>> ids;
+    // Block data containers, packed back to back in container_bytes when
+    // the copy is made, since the chunk can change or drop them while this
+    // is serialized. Each block index comes with the offset its container
+    // ends at.
+    std::vector<std::pair<uint16_t, size_t>> containers;
+    ByteWriter container_bytes;
+    std::vector<std::pair<uint16_t, HeightField>> height_fields;
+    uint64_t journal_record;
+    
+    // Packed and encoded as ChunkCodec::instance says, ready to store
+    void serialize(ByteWriter& out) const;
+};
+
 class Chunk {
     friend class ChunkView;
     
 public:
     double last_save, time_unloaded;
     bool needs_save;
+    bool journaled;     // Everything since the last save is in the EditJournal
+    // Newest EditJournal record applied to this chunk. Saved with it, so
+    // recovery knows which edits the saved copy already has.
+    uint64_t journal_record;
     
 private:
     ChunkPos chunk_pos;
@@ -31,6 +70,7 @@ private:
     uint16_t block_storage[sizes::chunk_storage_size];
     uint8_t block_rotation[sizes::chunk_storage_size];
     std::unordered_map<uint16_t, DataContainerPtr> data_containers;    
+    std::unordered_map<uint16_t, HeightField> height_fields;
     MeshPtr meshes[sizes::chunk_storage_size];
     
     
@@ -82,6 +122,9 @@ public:
     void setBlock(const BlockPos& pos, const std::string& name) {
         setBlock(pos, name, 0);
     }
+    // An edit read back from the EditJournal. Like setBlock without the
+    // events, which already happened the first time.
+    void replayBlock(const BlockPos& pos, const std::string& name, int rotation, uint64_t record);
     void updateBlock(const BlockPos& pos); // causes update event
     void repaintBlock(const BlockPos& pos); // causes repaint event
     void updateAllBlocks(bool no_load=false);  // Queue update event to all blocks
@@ -122,14 +165,24 @@ public:
     void tickAllBlocks(double elapsed_time);
     
     // Call after modifying data
-    void markDataModified() { needs_save = true; }
+    void markDataModified() {
+        needs_save = true;
+        journaled = false;
+    }
     DataContainerPtr getDataContainer(Block *block, bool create);
     void setDataContainer(Block *block, DataContainerPtr data);
+    HeightField *getHeightField(Block *block, bool create);
+    void clearHeightField(Block *block);
     
     void getCorners(BlockPos *pos, const BlockPos& center);
     
+    // Copy out everything that's saved and mark the chunk saved
+    void snapshot(ChunkSnapshot& snap);
+    // Save now, on this thread, if modified. SaveQueue does it in the
+    // background.
     void save();
     bool load();
+    void migrateHeightFields();
     
     void generate();
     
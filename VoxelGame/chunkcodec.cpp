@@ -0,0 +1,246 @@
+#include "chunkcodec.hpp"
+#include "filelocator.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Built with stb_image_write, which only declares it in the implementation
+extern "C" unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+// From stb_image
+extern "C" int stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
+
+ChunkCodec ChunkCodec::instance;
+
+// One "name value" per line
+void ChunkCodec::openWorld()
+{
+    std::string fname = FileLocator::instance.chunk("codec");
+    std::ifstream in(fname);
+    if (in.good()) {
+        std::string name;
+        int value;
+        while (in >> name >> value) {
+            if (name == "palette") {
+                palette = value != 0;
+            } else if (name == "deflate") {
+                deflate = value != 0;
+            } else if (name == "deflate_quality") {
+                deflate_quality = value < 5 ? 5 : value;
+            }
+        }
+    } else {
+        std::error_code ec;
+        std::filesystem::create_directories(FileLocator::instance.chunk(""), ec);
+        FILE *f = fopen(fname.c_str(), "w");
+        if (f) {
+            fprintf(f, "palette %d\ndeflate %d\ndeflate_quality %d\n", palette, deflate, deflate_quality);
+            fclose(f);
+        } else {
+            // Saves still use these, they just aren't remembered
+            std::cout << "Unable to write " << fname << std::endl;
+        }
+    }
+    std::cout << "Chunk codec: palette " << palette << ", deflate " << deflate << std::endl;
+}
+
+void ChunkCodec::encode(const char *data, size_t length, ByteWriter& out)
+{
+    uint8_t method = NONE;
+    unsigned char *compressed = 0;
+    int compressed_length = 0;
+    if (deflate) {
+        compressed = stbi_zlib_compress((unsigned char *)data, (int)length, &compressed_length, deflate_quality);
+        if (compressed) method = DEFLATE;
+    }
+
+    uint32_t unpacked = length;
+    out.put((char)marker);
+    out.put((char)version);
+    out.put((char)method);
+    out.put(&unpacked, 4);
+    if (compressed) {
+        out.put(compressed, compressed_length);
+        free(compressed);
+    } else {
+        out.put(data, length);
+    }
+}
+
+bool ChunkCodec::decode(const char *& data, size_t& length, std::vector<char>& scratch)
+{
+    if (!length || (uint8_t)data[0] != marker) return true;
+    if (length < header_size || data[1] != version) return false;
+
+    uint8_t method = data[2];
+    uint32_t unpacked;
+    memcpy(&unpacked, data + 3, 4);
+    const char *body = data + header_size;
+    size_t body_length = length - header_size;
+
+    switch (method) {
+    case NONE:
+        if (body_length != unpacked) return false;
+        data = body;
+        length = body_length;
+        return true;
+    case DEFLATE:
+        scratch.resize(unpacked);
+        if (stbi_zlib_decode_buffer(scratch.data(), unpacked, body, body_length) != (int)unpacked) return false;
+        data = scratch.data();
+        length = unpacked;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// A cell array starts with a mode byte. 0 means runs follow, each a varint
+// value and a varint length less one. Otherwise it's the number of bits
+// each value is packed into, low bits first.
+
+static void putVarint(ByteWriter& out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.put((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.put((char)v);
+}
+
+static bool getVarint(ByteReader& in, uint32_t& v)
+{
+    v = 0;
+    for (int shift=0; shift<32; shift+=7) {
+        if (in.atEnd()) return false;
+        uint8_t b = in.get();
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static int varintSize(uint32_t v)
+{
+    int n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+template<typename T>
+static void encodeCellsT(const T *values, size_t count, ByteWriter& out)
+{
+    uint32_t max_value = 0;
+    for (size_t i=0; i<count; i++) {
+        if (values[i] > max_value) max_value = values[i];
+    }
+    int bits = 1;
+    while (bits < 16 && (max_value >> bits)) bits++;
+    size_t packed_bytes = (count * bits + 7) / 8;
+
+    // Stop counting as soon as runs can't win, which for busy chunks is
+    // early on
+    size_t run_bytes = 0;
+    for (size_t i=0; i<count && run_bytes<=packed_bytes; ) {
+        size_t j = i + 1;
+        while (j < count && values[j] == values[i]) j++;
+        run_bytes += varintSize(values[i]) + varintSize(j - i - 1);
+        i = j;
+    }
+
+    if (run_bytes <= packed_bytes) {
+        out.put((char)0);
+        for (size_t i=0; i<count; ) {
+            size_t j = i + 1;
+            while (j < count && values[j] == values[i]) j++;
+            putVarint(out, values[i]);
+            putVarint(out, j - i - 1);
+            i = j;
+        }
+        return;
+    }
+
+    out.put((char)bits);
+    uint8_t *p = (uint8_t *)out.extend(packed_bytes);
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    for (size_t i=0; i<count; i++) {
+        acc |= (uint64_t)values[i] << acc_bits;
+        acc_bits += bits;
+        if (acc_bits >= 32) {
+            p[0] = (uint8_t)acc;
+            p[1] = (uint8_t)(acc >> 8);
+            p[2] = (uint8_t)(acc >> 16);
+            p[3] = (uint8_t)(acc >> 24);
+            p += 4;
+            acc >>= 32;
+            acc_bits -= 32;
+        }
+    }
+    for (; acc_bits > 0; acc_bits -= 8) {
+        *p++ = (uint8_t)acc;
+        acc >>= 8;
+    }
+}
+
+template<typename T>
+static bool decodeCellsT(const char *data, size_t length, T *values, size_t count)
+{
+    ByteReader in(data, length);
+    if (in.atEnd()) return false;
+    int bits = (uint8_t)in.get();
+
+    if (bits == 0) {
+        size_t i = 0;
+        while (i < count) {
+            uint32_t value, run;
+            if (!getVarint(in, value) || !getVarint(in, run)) return false;
+            if (run >= count - i) return false;
+            for (uint32_t k=0; k<=run; k++) values[i++] = (T)value;
+        }
+        return in.atEnd();
+    }
+
+    if (bits > 16 || (size_t)bits > sizeof(T) * 8) return false;
+    const uint8_t *p = (const uint8_t *)in.take((count * bits + 7) / 8);
+    if (!p || !in.atEnd()) return false;
+    const uint32_t mask = (1u << bits) - 1;
+    uint32_t acc = 0;
+    int acc_bits = 0;
+    for (size_t i=0; i<count; i++) {
+        while (acc_bits < bits) {
+            acc |= (uint32_t)*p++ << acc_bits;
+            acc_bits += 8;
+        }
+        values[i] = (T)(acc & mask);
+        acc >>= bits;
+        acc_bits -= bits;
+    }
+    return true;
+}
+
+void ChunkCodec::encodeCells(const uint16_t *values, size_t count, ByteWriter& out)
+{
+    encodeCellsT(values, count, out);
+}
+
+void ChunkCodec::encodeCells(const uint8_t *values, size_t count, ByteWriter& out)
+{
+    encodeCellsT(values, count, out);
+}
+
+bool ChunkCodec::decodeCells(const char *data, size_t length, uint16_t *values, size_t count)
+{
+    return decodeCellsT(data, length, values, count);
+}
+
+bool ChunkCodec::decodeCells(const char *data, size_t length, uint8_t *values, size_t count)
+{
+    return decodeCellsT(data, length, values, count);
+}
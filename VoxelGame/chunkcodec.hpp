@@ -0,0 +1,61 @@
+#ifndef INCLUDED_CHUNK_CODEC_HPP
+#define INCLUDED_CHUNK_CODEC_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "datacontainer.hpp"
+
+/*
+How saved chunks are compressed, chosen per world. openWorld reads the
+settings from a "codec" file next to the world's regions, or writes the
+current ones there for a new world, before anything is saved. Loading works
+out from the data what was used, so a world can change settings by editing
+the file, without converting.
+
+palette: The block and rotation arrays are stored as runs of equal values
+or bit-packed to the width of the largest value, whichever is smaller.
+Block IDs are already indices into each chunk's own palette (its "ids"),
+so they tend to be small.
+
+deflate: The whole packed chunk is compressed with stb's zlib.
+
+Stored chunks start with a header: a marker byte that can't start a packed
+container, the format version, the compression method and the unpacked
+length. Chunks without one were saved before there was a header.
+*/
+class ChunkCodec {
+public:
+    static ChunkCodec instance;
+
+    enum Compression {
+        NONE = 0,
+        DEFLATE = 1
+    };
+
+    static constexpr uint8_t marker = 0xff;
+    static constexpr uint8_t version = 1;
+    static constexpr size_t header_size = 7;
+
+    bool palette;
+    bool deflate;
+    int deflate_quality;    // 5 or more; higher is smaller and slower
+
+    ChunkCodec() : palette(true), deflate(false), deflate_quality(5) {}
+
+    // Settings of the world in FileLocator's storage dir
+    void openWorld();
+
+    // Header plus packed chunk, compressed or not, into out
+    void encode(const char *data, size_t length, ByteWriter& out);
+    // Find the packed chunk in stored bytes, decompressing into scratch if
+    // needed. Returns false if it's damaged or from a newer version.
+    static bool decode(const char *& data, size_t& length, std::vector<char>& scratch);
+
+    // Arrays of cells, for palette. Appends to out.
+    static void encodeCells(const uint16_t *values, size_t count, ByteWriter& out);
+    static void encodeCells(const uint8_t *values, size_t count, ByteWriter& out);
+    static bool decodeCells(const char *data, size_t length, uint16_t *values, size_t count);
+    static bool decodeCells(const char *data, size_t length, uint8_t *values, size_t count);
+};
+
+#endif
@@ -2,55 +2,39 @@
 #include "block.hpp"
 #include "world.hpp"
 #include "compat.hpp"
+#include "meshcache.hpp"
+#include <math.h>
+
+double ChunkView::lod_distance[ChunkView::NUM_LOD] = { 0, 64, 128 };
+double ChunkView::lod_hysteresis = 8;
 
 ChunkView::ChunkView(Chunk *c)
 {
     chunk = c;
     memset(block_show_faces, 0, sizeof(block_show_faces));
     markChunkUpdated();
-    trans = 0;
-    trans_alt = 0;
+    front_slot = 0;
+    ready_slot = 1;
+    back_slot = 2;
+    last_published = 1;
+    num_published = 0;
+    connectivity = ALL_FACES_CONNECTED;
+    lod = 0;
 }
 
 void ChunkView::markChunkUpdated()
 {
     memset(block_visual_modified, 1, sizeof(block_visual_modified));
     chunk_visual_modified = true;
+    all_blocks_modified = true;
 }
 
 ChunkView::~ChunkView()
 {
-    RenderManager::instance.queueDeleteRenderer(render);
-    RenderManager::instance.queueDeleteRenderer(render_alt);
-    if (trans) {
-        RenderManager::instance.queueDeleteRenderer(*trans);
-        delete trans;
-    }
-    if (trans_alt) {
-        RenderManager::instance.queueDeleteRenderer(*trans_alt);
-        delete trans_alt;
-    }
-
-#if 0    
-    for (auto i=render.begin(); i!=render.end(); ++i) {
-        if (*i) delete *i;
-    }
-    for (auto i=render_alt.begin(); i!=render_alt.end(); ++i) {
-        if (*i) delete *i;
-    }
-    if (trans) {
-        for (auto i=trans->begin(); i!=trans->end(); ++i) {
-            if (*i) delete *i;
-        }
-        delete trans;
-    }
-    if (trans_alt) {
-        for (auto i=trans_alt->begin(); i!=trans_alt->end(); ++i) {
-            if (*i) delete *i;
-        }
-        delete trans_alt;
+    for (int i=0; i<3; i++) {
+        RenderManager::instance.queueDeleteRenderer(packets[i].render);
+        RenderManager::instance.queueDeleteRenderer(packets[i].trans);
     }
-#endif
 }
 
 void ChunkView::updateAllBlockFaces()
@@ -118,95 +102,285 @@ void ChunkView::updateBlockFaces(int index, const BlockPos& pos)
     }
 }
 
-void ChunkView::computeAllRenders(const BlockPos& center)
+// Only full, non-translucent cubes block the view
+void ChunkView::updateConnectivity()
+{
+    bool opaque[sizes::chunk_storage_size];
+    for (int i=0; i<sizes::chunk_storage_size; i++) {
+        if (!chunk->block_storage[i]) {
+            opaque[i] = false;
+            continue;
+        }
+        MeshPtr mesh = chunk->getMesh(i);
+        opaque[i] = mesh && !mesh->isTranslucent() && mesh->getSolidFaces() == facing::ALL_FACES;
+    }
+    connectivity = OcclusionCuller::computeConnectivity(opaque);
+}
+
+// Where a mesh's texture lives among TextureLibrary's arrays. Fails if the
+// texture isn't one that was loaded when this pass started.
+static bool lookupLayer(const MeshPtr& mesh, size_t num_tex, int& array_id, int& layer)
+{
+    int texture_id = mesh->getTextureIndex();
+    if (texture_id < 0 || texture_id >= num_tex) return false;
+    Texture *tex = TextureLibrary::instance.getTexture(texture_id);
+    array_id = tex->getArrayIndex();
+    layer = tex->getLayer();
+    return true;
+}
+
+void ChunkView::getArrayData(ChunkRenderPacket& packet, size_t num_arrays, std::vector<RenderData *>& out)
+{
+    if (packet.render.size() < num_arrays) packet.render.resize(num_arrays);
+    out.resize(num_arrays);
+    for (size_t ai=0; ai<num_arrays; ai++) {
+        if (!packet.render[ai]) packet.render[ai] = new Renderer(TextureLibrary::instance.getArray(ai));
+        out[ai] = packet.render[ai]->getData();
+    }
+}
+
+void ChunkView::computeAllRenders(ChunkRenderPacket& packet, const BlockPos& center)
 {
     //if (!needs_update_render) return;
     // std::cout << "computeMeshes need=" << needs_update_mesh << std::endl;
     //needs_update_render = false;
     
+    // Arrays are added before the textures in them, so every texture
+    // counted here has its array counted too
     size_t num_tex = TextureLibrary::instance.numTextures();
-    if (render.size() < num_tex) {
-        render_is_valid = false;
-        COMPILER_BARRIER();
-        render.resize(num_tex);
-    }
-    if (render_alt.size() < num_tex) {
-        render_is_valid = false;
-        COMPILER_BARRIER();
-        render_alt.resize(num_tex);
+    size_t num_arrays = TextureLibrary::instance.numArrays();
+    std::vector<RenderData *> unused;
+    getArrayData(packet, num_arrays, unused);
+    
+    if (lod) {
+        computeLodCache(lod, num_tex, num_arrays);
+    } else {
+        countArrayVertices(num_tex, num_arrays);
     }
     
-    // std::cout << "computeMeshes Num tex: " << num_tex << std::endl;
-    draw_frustum_center = center;
-    for (int ti=0; ti<num_tex; ti++) {
-        computeTextureRender(ti, center);
+    // std::cout << "computeMeshes Num arrays: " << num_arrays << std::endl;
+    for (int ai=0; ai<num_arrays; ai++) {
+        computeArrayRender(packet, ai, center);
     }
 }
 
-void ChunkView::computeTextureRender(int texture_id, const BlockPos& center)
+void ChunkView::computeArrayRender(ChunkRenderPacket& packet, int array_id, const BlockPos& center)
 {
     // std::cout << "Computing render" << std::endl;
-    Renderer *mr1 = render_alt[texture_id];
-    if (!mr1) mr1 = new Renderer(TextureLibrary::instance.getTexture(texture_id));
+    Renderer *mr1 = packet.render[array_id];
     
-    // Save center in render for proper alignment when rendering
-    mr1->setCenter(center);
-    
-    renderIterateBlocks(mr1->getData(), texture_id, center);
+    if (lod) {
+        // Cached meshes are relative to the chunk corner, so move them to
+        // the shared center
+        RenderData *render_data = mr1->getData();
+        *render_data = lod_cache[lod].data[array_id];
+        BlockPos corner = BlockPos::getBlockPos(chunk->getChunkPos());
+        float dx = corner.X - center.X, dy = corner.Y - center.Y, dz = corner.Z - center.Z;
+        std::vector<float>& v(render_data->vertices);
+        for (size_t j=0; j<v.size(); j+=3) {
+            v[j+0] += dx;
+            v[j+1] += dy;
+            v[j+2] += dz;
+        }
+        mr1->setCenter(center);
+    } else {
+        // Save center in render for proper alignment when rendering
+        mr1->setCenter(center);
+        renderIterateBlocks(mr1->getData(), array_id, center);
+    }
     mr1->setNeedsLoad();
-    
-    Renderer *mr2 = render[texture_id];
-    if (!mr2) mr2 = new Renderer(TextureLibrary::instance.getTexture(texture_id));
-    
-    // Swap updated render into place
-    render_alt[texture_id] = mr2;
-    render[texture_id] = mr1;
 }
 
-void ChunkView::renderIterateBlocks(RenderData *render_data, int texture_id, const BlockPos& center)
+// Cheap pass over the chunk that only counts, so that meshing doesn't
+// have to grow its vectors as it goes
+void ChunkView::countArrayVertices(size_t num_tex, size_t num_arrays)
 {
-    glm::mat4 rot_matrix;
-    
-    render_data->clear();
+    array_blocks.resize(num_arrays);
+    array_vertices.assign(num_arrays, 0);
+    for (size_t ai=0; ai<num_arrays; ai++) array_blocks[ai].clear();
     
     for (int i=0; i<sizes::chunk_storage_size; i++) {
         int block_id = chunk->block_storage[i];
         if (!block_id) continue;
         
-        // std::cout << "getting block shape\n";
         MeshPtr mesh = chunk->getMesh(i);
         if (mesh->isTranslucent()) continue; // Skip translucent blocks
         
-        int shape_tex_id = mesh->getTextureIndex();
-        if (shape_tex_id != texture_id) continue;
+        int array_id, layer;
+        if (!lookupLayer(mesh, num_tex, array_id, layer)) continue;
         
+        int show_faces = facing::rotateFaces(block_show_faces[i], chunk->getRotation(i));
+        int num_vertices = mesh->numQuadVertices(show_faces);
+        if (!num_vertices) continue;
+        
+        array_blocks[array_id].push_back(i);
+        array_vertices[array_id] += num_vertices;
+    }
+}
+
+void ChunkView::renderIterateBlocks(RenderData *render_data, int array_id, const BlockPos& center)
+{
+    glm::mat4 rot_matrix;
+    size_t num_tex = TextureLibrary::instance.numTextures();
+    
+    render_data->clear();
+    if (!array_vertices[array_id]) {
+        render_data->release();
+        return;
+    }
+    render_data->reserve(array_vertices[array_id]);
+    
+    for (uint16_t i : array_blocks[array_id]) {
+        MeshPtr mesh = chunk->getMesh(i);
         BlockPos blockpos = chunk->decodeIndex(i);
         
+        int unused, layer;
+        lookupLayer(mesh, num_tex, unused, layer);
+        
         int rotation = chunk->getRotation(i);
         int show_faces = facing::rotateFaces(block_show_faces[i], rotation);        
         if (rotation) {
             // std::cout << "rotation\n";
             rot_matrix = Mesh::getRotationMatrix(rotation);
-            mesh->getTriangleVertices(show_faces, render_data->vertices, rot_matrix, blockpos, center);
-            mesh->getTriangleNormals(show_faces, render_data->normals, rot_matrix);
+            mesh->getQuadVertices(show_faces, render_data->vertices, rot_matrix, blockpos, center);
+            mesh->getQuadNormals(show_faces, render_data->normals, rot_matrix);
         } else {
-            mesh->getTriangleVertices(show_faces, render_data->vertices, blockpos, center);
-            mesh->getTriangleNormals(show_faces, render_data->normals);
+            mesh->getQuadVertices(show_faces, render_data->vertices, blockpos, center);
+            mesh->getQuadNormals(show_faces, render_data->normals);
         }
         
-        mesh->getTriangleTexCoords(show_faces, render_data->texcoords);
-        render_data->total_vertices += mesh->numTriangleVertices(show_faces);
+        mesh->getQuadTexCoords(show_faces, render_data->texcoords, layer);
+        render_data->total_vertices += mesh->numQuadVertices(show_faces);
         
         // std::cout << "Block at pos " << blockpos.toString() << " vertices:" << mesh_data->total_vertices << " center:" << center.toString() << std::endl;
     }
 }
 
-void ChunkView::transIterateBlocks(const BlockPos& center)
+int ChunkView::chooseLod(const BlockPos& center)
+{
+    BlockPos corner = BlockPos::getBlockPos(chunk->getChunkPos());
+    double dx = corner.X + 8 - center.X;
+    double dy = corner.Y + 8 - center.Y;
+    double dz = corner.Z + 8 - center.Z;
+    double dist = sqrt(dx*dx + dy*dy + dz*dz);
+    
+    int level = lod;
+    while (level+1 < NUM_LOD && dist > lod_distance[level+1] + lod_hysteresis) level++;
+    while (level > 0 && dist < lod_distance[level] - lod_hysteresis) level--;
+    return level;
+}
+
+// Downsample the chunk into cells of 2^level blocks. A cell is filled if at
+// least a quarter of it is solid, and is drawn as the most common solid
+// block in it, scaled up to the cell size. Translucent blocks count as empty
+// and aren't drawn at reduced detail, and blocks use their type's default
+// mesh without rotation.
+void ChunkView::computeLodCache(int level, size_t num_tex, size_t num_arrays)
+{
+    LodCache& cache(lod_cache[level]);
+    if (cache.valid && cache.data.size() == num_arrays) return;
+    
+    const int scale = 1 << level;
+    const int cells = 16 >> level;
+    const int per_cell = scale * scale * scale;
+    std::vector<MeshPtr> cell_mesh(cells * cells * cells);
+    
+    for (int cy=0; cy<cells; cy++) {
+        for (int cz=0; cz<cells; cz++) {
+            for (int cx=0; cx<cells; cx++) {
+                uint16_t ids[64], counts[64], first[64];
+                int num_ids = 0, solid = 0;
+                for (int y=cy*scale; y<(cy+1)*scale; y++) {
+                    for (int z=cz*scale; z<(cz+1)*scale; z++) {
+                        for (int x=cx*scale; x<(cx+1)*scale; x++) {
+                            uint16_t index = Chunk::chunkBlockIndex(BlockPos(x, y, z));
+                            uint16_t block_id = chunk->block_storage[index];
+                            if (!block_id) continue;
+                            if (chunk->getDefaultMesh(index)->isTranslucent()) continue;
+                            solid++;
+                            int j = 0;
+                            while (j<num_ids && ids[j] != block_id) j++;
+                            if (j == num_ids) {
+                                ids[j] = block_id;
+                                counts[j] = 0;
+                                first[j] = index;
+                                num_ids++;
+                            }
+                            counts[j]++;
+                        }
+                    }
+                }
+                if (solid * 4 < per_cell) continue;
+                
+                int best = 0;
+                for (int j=1; j<num_ids; j++) {
+                    if (counts[j] > counts[best]) best = j;
+                }
+                cell_mesh[cx + cells * (cz + cells * cy)] = chunk->getDefaultMesh(first[best]);
+            }
+        }
+    }
+    
+    cache.data.clear();
+    cache.data.resize(num_arrays, RenderData(3));
+    
+    for (int cy=0; cy<cells; cy++) {
+        for (int cz=0; cz<cells; cz++) {
+            for (int cx=0; cx<cells; cx++) {
+                MeshPtr mesh = cell_mesh[cx + cells * (cz + cells * cy)];
+                if (!mesh) continue;
+                
+                // Same rule as updateBlockFaces for opaque blocks. Faces on
+                // the chunk boundary are always shown since the neighbor
+                // may be at a different level.
+                int show_faces = 0;
+                for (int face=0; face<facing::NUM_FACES; face++) {
+                    const int *vec = facing::int_vector[face];
+                    int nx = cx + vec[0], ny = cy + vec[1], nz = cz + vec[2];
+                    bool visible = true;
+                    if (nx >= 0 && ny >= 0 && nz >= 0 && nx < cells && ny < cells && nz < cells) {
+                        MeshPtr neighbor_mesh = cell_mesh[nx + cells * (nz + cells * ny)];
+                        if (neighbor_mesh && mesh->faceIsSolid(face) &&
+                            neighbor_mesh->faceIsSolid(facing::oppositeFace(face))) visible = false;
+                    }
+                    show_faces |= facing::bitmask(face, visible);
+                }
+                
+                int array_id, layer;
+                if (!lookupLayer(mesh, num_tex, array_id, layer)) continue;
+                RenderData& render_data(cache.data[array_id]);
+                
+                // Emit a unit block at the cell origin and stretch it about
+                // that origin. Mesh coordinates run 0..1 within the block.
+                BlockPos offset(cx * scale, cy * scale, cz * scale);
+                size_t start = render_data.vertices.size();
+                mesh->getQuadVertices(show_faces, render_data.vertices, offset, BlockPos(0, 0, 0));
+                for (size_t j=start; j<render_data.vertices.size(); j+=3) {
+                    render_data.vertices[j+0] = offset.X + (render_data.vertices[j+0] - offset.X) * scale;
+                    render_data.vertices[j+1] = offset.Y + (render_data.vertices[j+1] - offset.Y) * scale;
+                    render_data.vertices[j+2] = offset.Z + (render_data.vertices[j+2] - offset.Z) * scale;
+                }
+                mesh->getQuadNormals(show_faces, render_data.normals);
+                mesh->getQuadTexCoords(show_faces, render_data.texcoords, layer);
+                render_data.total_vertices += mesh->numQuadVertices(show_faces);
+            }
+        }
+    }
+    
+    cache.valid = true;
+}
+
+void ChunkView::transIterateBlocks(ChunkRenderPacket& packet, const BlockPos& center)
 {
     glm::mat4 rot_matrix;
-    std::vector<Renderer *> *new_trans = new std::vector<Renderer *>();
     
-    for (int i=0; i<sizes::chunk_storage_size; i++) {
+    // The graphics thread may still be sorting these if it drew this packet
+    // last frame, so they're deleted later from the graphics thread
+    RenderManager::instance.queueDeleteRenderer(packet.trans);
+    packet.trans.clear();
+    
+    // Translucent blocks are left out at reduced detail
+    for (int i=0; i<sizes::chunk_storage_size && !lod; i++) {
         int block_id = chunk->block_storage[i];
         if (!block_id) continue;
         
@@ -214,8 +388,8 @@ void ChunkView::transIterateBlocks(const BlockPos& center)
         MeshPtr mesh = chunk->getMesh(i);
         if (!mesh->isTranslucent()) continue; // Skip solid blocks
         
-        int shape_tex_id = mesh->getTextureIndex();
-        Renderer *render = new Renderer(TextureLibrary::instance.getTexture(mesh->getTextureIndex()));
+        Texture *tex = TextureLibrary::instance.getTexture(mesh->getTextureIndex());
+        Renderer *render = new Renderer(TextureLibrary::instance.getArray(tex->getArrayIndex()));
         render->setNeedsLoad();
         render->setCenter(center);
         RenderData *render_data = render->getData();
@@ -227,112 +401,189 @@ void ChunkView::transIterateBlocks(const BlockPos& center)
         int show_faces = facing::rotateFaces(block_show_faces[i], rotation);        
         if (rotation) {
             rot_matrix = Mesh::getRotationMatrix(rotation);
-            mesh->getTriangleVertices(show_faces, render_data->vertices, rot_matrix, blockpos, center);
-            mesh->getTriangleNormals(show_faces, render_data->normals, rot_matrix);
+            mesh->getQuadVertices(show_faces, render_data->vertices, rot_matrix, blockpos, center);
+            mesh->getQuadNormals(show_faces, render_data->normals, rot_matrix);
         } else {
-            mesh->getTriangleVertices(show_faces, render_data->vertices, blockpos, center);
-            mesh->getTriangleNormals(show_faces, render_data->normals);
+            mesh->getQuadVertices(show_faces, render_data->vertices, blockpos, center);
+            mesh->getQuadNormals(show_faces, render_data->normals);
         }
 
-        mesh->getTriangleTexCoords(show_faces, render_data->texcoords);
-        render_data->total_vertices += mesh->numTriangleVertices(show_faces);
+        mesh->getQuadTexCoords(show_faces, render_data->texcoords, tex->getLayer());
+        render_data->total_vertices += mesh->numQuadVertices(show_faces);
         
-        new_trans->push_back(render);
+        packet.trans.push_back(render);
     }
     
-    // std::cout << "Trans made renders: " << new_trans->size() << std::endl;
-    
-    // Get a copy of the old alt
-    std::vector<Renderer *> *old_trans = trans_alt;
-    COMPILER_BARRIER();
-    // Shift old trans into alt and new trans into trans
-    trans_alt = trans;
-    trans = new_trans;
-    COMPILER_BARRIER();
-    // Delete the old alt
-    if (old_trans) {
-        // std::cout << "Deleting trans renderer size=" << old_trans->size() << std::endl;
-        RenderManager::instance.queueDeleteRenderer(*old_trans);
-        delete old_trans;
-    }
+    // std::cout << "Trans made renders: " << packet.trans.size() << std::endl;
 }
 
-void ChunkView::copyTransRenders(std::vector<Renderer *>& all_trans)
+void ChunkView::publishPacket()
 {
-    std::vector<Renderer *> *old_trans = trans;
-    COMPILER_BARRIER();
-    if (!old_trans) return;
-    all_trans.insert(std::end(all_trans), std::begin(*old_trans), std::end(*old_trans));
+    packets[back_slot].generation = ++num_published;
+    last_published = back_slot;
+    // Release makes the packet's contents visible to the graphics thread
+    // before its index is; acquire does the same for whatever the graphics
+    // thread last did with the packet that comes back.
+    uint8_t old = ready_slot.exchange(back_slot | packet_fresh, std::memory_order_acq_rel);
+    back_slot = old & packet_index_mask;
 }
 
+static void addRenderStats(Renderer *r, size_t& vertices, size_t& bytes)
+{
+    if (!r) return;
+    RenderData *data = r->getData();
+    vertices += data->total_vertices;
+    bytes += (data->vertices.size() + data->texcoords.size() + data->normals.size()) * sizeof(float);
+}
 
-bool ChunkView::insideFrustum(const glm::mat4& view, const BlockPos& center)
+// Headless tools never consume packets, so the last published one is
+// still untouched when they ask
+void ChunkView::addMeshStats(size_t& vertices, size_t& bytes)
 {
-    if (!chunk) return false;
-    BlockPos corners[8];
-    chunk->getCorners(corners, center);
-    glm::mat4 xform = projection * view;
-    
-    int reduction = -1;
-    for (int i=0; i<8; i++) {
-        int outside = WorldView::outsideFrustum(xform, corners[i]);
-        reduction &= outside;
-        if (reduction == 0) return true;
+    const ChunkRenderPacket& packet(packets[last_published]);
+    for (Renderer *r : packet.render) addRenderStats(r, vertices, bytes);
+    for (Renderer *r : packet.trans) addRenderStats(r, vertices, bytes);
+}
+
+void ChunkView::releaseRenderData()
+{
+    for (int i=0; i<3; i++) {
+        for (Renderer *r : packets[i].render) if (r) r->getData()->release();
+        for (Renderer *r : packets[i].trans) r->getData()->release();
+    }
+}
+
+
+// What MeshCache knows the chunk being meshed by
+static thread_local MeshCache::Key mesh_key;
+
+bool ChunkView::makeMeshKey(size_t num_tex, size_t num_arrays)
+{
+    mesh_key.clear(num_tex, num_arrays);
+    bool any = false;
+    for (int i=0; i<sizes::chunk_storage_size; i++) {
+        if (chunk->block_storage[i]) {
+            mesh_key.addBlock(chunk->getMesh(i), chunk->getRotation(i));
+            any = true;
+        } else {
+            mesh_key.addBlock(MeshPtr(), 0);
+        }
     }
+    if (!any) return false;
     
-    return reduction == 0;
+    // The layer of blocks facing this chunk across each border, as
+    // updateBlockFaces sees them
+    const ChunkPos& cpos(chunk->getChunkPos());
+    for (int face=0; face<facing::NUM_FACES; face++) {
+        const int *vec = facing::int_vector[face];
+        Chunk *neighbor = World::instance.getChunk(ChunkPos(cpos.X + vec[0], cpos.Y + vec[1], cpos.Z + vec[2]), World::NoLoad);
+        for (int a=0; a<16; a++) {
+            for (int b=0; b<16; b++) {
+                int c[3], k = 0;
+                for (int axis=0; axis<3; axis++) {
+                    if (vec[axis]) {
+                        c[axis] = vec[axis] > 0 ? 0 : 15;
+                    } else {
+                        c[axis] = k++ ? b : a;
+                    }
+                }
+                uint16_t index = c[0] | (c[2] << 4) | (c[1] << 8);
+                if (neighbor && neighbor->block_storage[index]) {
+                    mesh_key.addBlock(neighbor->getMesh(index), neighbor->getRotation(index));
+                } else {
+                    mesh_key.addBlock(MeshPtr(), 0);
+                }
+            }
+        }
+        // Keep runs from crossing into the next border
+        mesh_key.addRun(MeshPtr(), -1);
+    }
+    mesh_key.finish();
+    return true;
 }
 
-void ChunkView::computeUpdates(const BlockPos& center, const glm::mat4& projection, const glm::mat4& view)
+void ChunkView::computeUpdates(const BlockPos& center)
 {
-    setProjection(projection);
-    // BlockPos center = geom::computeCenter(camera_pos);
-    // glm::mat4 view = camera->getViewMatrix(center.X, center.Y, center.Z);
+    int new_lod = chooseLod(center);
+    bool modified = chunk_visual_modified;
+    if (!modified && new_lod == lod) return;
     
-    if (!insideFrustum(view, center)) {
-        // std::cout << "Skipping chunk\n";
-        // render_is_valid = false;
-        return;
+    lod = new_lod;
+    BlockPos mesh_center(center.X & ~(center_snap-1), center.Y & ~(center_snap-1), center.Z & ~(center_snap-1));
+    ChunkRenderPacket& packet(packets[back_slot]);
+    
+    // A chunk meshed from scratch may well repeat one meshed before. Marks
+    // made while the key is built leave chunk_visual_modified set, so those
+    // blocks are looked at again next time.
+    size_t num_tex = TextureLibrary::instance.numTextures();
+    size_t num_arrays = TextureLibrary::instance.numArrays();
+    BlockPos corner = BlockPos::getBlockPos(chunk->getChunkPos());
+    BlockPos offset(corner.X - mesh_center.X, corner.Y - mesh_center.Y, corner.Z - mesh_center.Z);
+    std::vector<RenderData *> array_data;
+    bool use_cache = modified && all_blocks_modified && !lod && MeshCache::instance.enabled;
+    bool cached = false;
+    if (use_cache) {
+        chunk_visual_modified = false;
+        all_blocks_modified = false;
+        memset(block_visual_modified, 0, sizeof(block_visual_modified));
+        use_cache = makeMeshKey(num_tex, num_arrays);
+    }
+    if (use_cache) {
+        getArrayData(packet, num_arrays, array_data);
+        FaceConnectivity conn;
+        cached = MeshCache::instance.fetch(mesh_key, offset, array_data.data(), num_arrays, block_show_faces, conn);
+        if (cached) {
+            connectivity = conn;
+            for (int i=0; i<NUM_LOD; i++) lod_cache[i].valid = false;
+            for (size_t ai=0; ai<num_arrays; ai++) {
+                packet.render[ai]->setCenter(mesh_center);
+                packet.render[ai]->setNeedsLoad();
+            }
+        } else {
+            memset(block_visual_modified, 1, sizeof(block_visual_modified));
+        }
     }
     
-    if (chunk_visual_modified) {
+    if (modified && !cached) {
         chunk_visual_modified = false;
+        all_blocks_modified = false;
 
         updateAllBlockFaces();
-        computeAllRenders(center);
-        transIterateBlocks(center);
+        updateConnectivity();
+        for (int i=0; i<NUM_LOD; i++) lod_cache[i].valid = false;
     }
-
-    COMPILER_BARRIER();
-    render_is_valid = true;
+    
+    if (!cached) computeAllRenders(packet, mesh_center);
+    if (use_cache && !cached) {
+        MeshCache::instance.insert(mesh_key, offset, array_data.data(), num_arrays, block_show_faces, connectivity);
+    }
+    transIterateBlocks(packet, mesh_center);
+    publishPacket();
 }
 
-void ChunkView::draw(Shader *shader, CameraModel *camera)
+void ChunkView::addDraws(DrawList& list, Shader *shader)
 {
-    bool did_frustum_check = false;
-    
-    if (!render_is_valid) return;
-    COMPILER_BARRIER();
+    if (ready_slot.load(std::memory_order_relaxed) & packet_fresh) {
+        // Nothing has been queued from the old packet this frame, so its
+        // arena ranges can go now. Its translucent renderers may still be
+        // held by TransSorter; those wait for the compute thread to reuse
+        // the packet.
+        for (Renderer *r : packets[front_slot].render) if (r) r->unload();
+        uint8_t fresh = ready_slot.exchange(front_slot, std::memory_order_acq_rel);
+        front_slot = fresh & packet_index_mask;
+    }
     
-    size_t num_tex = render.size();
-    // std::cout << "Drawing chunk " << chunk->chunk_pos.toString() << " num_tex:" << num_tex << std::endl;
-    for (int i=0; i<num_tex; i++) {
-        COMPILER_BARRIER();
-        if (!render_is_valid) return;
-        COMPILER_BARRIER();
-
-        Renderer *mr = render[i];
+    const ChunkRenderPacket& packet(packets[front_slot]);
+    // std::cout << "Drawing chunk " << chunk->chunk_pos.toString() << " num_arrays:" << packet.render.size() << std::endl;
+    for (Renderer *mr : packet.render) {
         if (!mr) continue;
-        const BlockPos& center(mr->getCenter());
-        glm::mat4 view = camera->getViewMatrix(center.X, center.Y, center.Z);
-        
-        if (!did_frustum_check) {
-            if (!insideFrustum(view, center)) return;
-            did_frustum_check = true;
-        }
-        
-        shader->setMat4("view", view);
-        mr->load_buffers();
-        mr->draw(shader);
+        mr->addDraw(list, shader);
     }
 }
+
+const std::vector<Renderer *> *ChunkView::getTransRenders(unsigned int& generation)
+{
+    const ChunkRenderPacket& packet(packets[front_slot]);
+    generation = packet.generation;
+    return &packet.trans;
+}
@@ -5,29 +5,88 @@ class Chunk;
 #include "chunk.hpp"
 #include "render.hpp"
 #include "position.hpp"
+#include "occlusion.hpp"
+#include <atomic>
+
+/*
+Everything the graphics thread needs to draw one chunk, as produced by one
+meshing pass. The compute thread fills a packet and publishes it whole; it
+doesn't change again until the graphics thread has let go of it.
+*/
+struct ChunkRenderPacket {
+    // One renderer per texture array (see TextureLibrary::getArray)
+    std::vector<Renderer *> render;
+    // Translucent objects: One renderer per block
+    std::vector<Renderer *> trans;
+    // Different for every packet published by a chunk
+    unsigned int generation;
+    
+    ChunkRenderPacket() : generation(0) {}
+};
 
 class ChunkView {
     friend class Chunk;
     
+public:
+    // Level of detail. Level n meshes the chunk from cells of 2^n blocks.
+    static constexpr int NUM_LOD = 3;
+    // Level n is used for chunks whose middle is more than lod_distance[n]
+    // blocks from the camera. Switching happens lod_hysteresis blocks past
+    // each threshold so chunks near one don't flip back and forth.
+    static double lod_distance[NUM_LOD];
+    static double lod_hysteresis;
+    
+    // Meshes are made relative to the camera position rounded down to a
+    // multiple of this, so chunks meshed while the camera is in the same
+    // cell share a center and can be drawn together (see DrawList)
+    static constexpr int center_snap = 64;
+    
 private:
     Chunk *chunk;
     
     // Visual update flags
     bool block_visual_modified[sizes::chunk_storage_size];
     bool chunk_visual_modified;
+    // Every block was marked, as for a newly loaded chunk (see MeshCache)
+    bool all_blocks_modified;
         
     uint8_t block_show_faces[sizes::chunk_storage_size];
     //bool needs_update_render;
-    volatile bool render_is_valid;
 
-    glm::mat4 projection;
-    // BlockPos center;
-    BlockPos draw_frustum_center;
-    // XXX need mutex around resizing of these vectors!
-    std::vector<Renderer *> render, render_alt;
+    // Triple buffer of render packets. The compute thread only touches
+    // packets[back_slot] and the graphics thread only packets[front_slot].
+    // The third is handed between them by swapping its index through
+    // ready_slot, with packet_fresh set when the compute thread put it there.
+    static constexpr uint8_t packet_index_mask = 3;
+    static constexpr uint8_t packet_fresh = 4;
+    ChunkRenderPacket packets[3];
+    std::atomic<uint8_t> ready_slot;
+    uint8_t back_slot;          // Compute thread only
+    uint8_t front_slot;         // Graphics thread only
+    uint8_t last_published;     // Compute thread only
+    unsigned int num_published; // Compute thread only
     
-    // Translucent objects: One renderer per block
-    std::vector<Renderer *> *trans, *trans_alt;
+    // Which faces see each other through this chunk, for OcclusionCuller.
+    // Starts fully connected until the chunk is first meshed.
+    std::atomic<FaceConnectivity> connectivity;
+    
+    // Level the current renders were made at (compute thread only)
+    int lod;
+    
+    // Reduced meshes are kept per level, one RenderData per texture array, until
+    // the chunk changes. They are relative to the chunk's corner so they
+    // stay valid as the camera moves.
+    struct LodCache {
+        bool valid;
+        std::vector<RenderData> data;
+        LodCache() : valid(false) {}
+    };
+    LodCache lod_cache[NUM_LOD];
+    
+    // Opaque blocks grouped by texture array, and the vertices each array's
+    // render will need, so buffers can be sized before meshing
+    std::vector<std::vector<uint16_t>> array_blocks;
+    std::vector<int> array_vertices;
     
     void setShowFace(int index, int face, bool val) {
         block_show_faces[index] &= ~facing::bitmask(face);
@@ -47,25 +106,44 @@ public:
     
     // Configure the camera position for centering
     // void setCameraPos(const glm::dvec3& camera_pos);
-    void setProjection(const glm::mat4& pr) {
-        projection = pr;
-    }
-    bool insideFrustum(const glm::mat4& view, const BlockPos& center);
     
     // Recompute block face visibility
     void updateAllBlockFaces();
     void updateBlockFaces(int index, const BlockPos& pos);
+    void updateConnectivity();
+    FaceConnectivity getConnectivity() { return connectivity; }
     
     // Methods for render compute thread
-    void computeAllRenders(const BlockPos& center);
-    void computeTextureRender(int texture_id, const BlockPos& center);
-    void renderIterateBlocks(RenderData *render, int texture_id, const BlockPos& center);
-    void transIterateBlocks(const BlockPos& center);
-    void copyTransRenders(std::vector<Renderer *>& all_trans);
-    void computeUpdates(const BlockPos& center, const glm::mat4& projection, const glm::mat4& view);
+    void computeAllRenders(ChunkRenderPacket& packet, const BlockPos& center);
+    void computeArrayRender(ChunkRenderPacket& packet, int array_id, const BlockPos& center);
+    void countArrayVertices(size_t num_tex, size_t num_arrays);
+    void renderIterateBlocks(RenderData *render, int array_id, const BlockPos& center);
+    int chooseLod(const BlockPos& center);
+    void computeLodCache(int level, size_t num_tex, size_t num_arrays);
+    void transIterateBlocks(ChunkRenderPacket& packet, const BlockPos& center);
+    // The packet's render data for every texture array
+    void getArrayData(ChunkRenderPacket& packet, size_t num_arrays, std::vector<RenderData *>& out);
+    // Fill in the MeshCache key for this chunk. Returns false if there's
+    // nothing in the chunk to mesh.
+    bool makeMeshKey(size_t num_tex, size_t num_arrays);
+    // Hand packets[back_slot] to the graphics thread and take back whichever
+    // packet it isn't using
+    void publishPacket();
+    // Add up the vertices and CPU-side vertex data of the last published packet
+    void addMeshStats(size_t& vertices, size_t& bytes);
+    // Drop CPU copies of render data as drawing would after uploading them.
+    // For headless tools, which never upload.
+    void releaseRenderData();
+    // Frustum culling is done by the caller (see ChunkCuller)
+    void computeUpdates(const BlockPos& center);
     
     // Methods for graphics thread
-    void draw(Shader *shader, CameraModel *camera);
+    // Switches to the newest published packet, if there is one, before
+    // adding its draws
+    void addDraws(DrawList& list, Shader *shader);
+    // From the packet addDraws last used. The list and its renderers stay
+    // valid until the generation changes.
+    const std::vector<Renderer *> *getTransRenders(unsigned int& generation);
 };
 
 #endif
\ No newline at end of file
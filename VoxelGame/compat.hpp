@@ -7,7 +7,7 @@ inline int double2int(double d)
     return reinterpret_cast<int&>(d);
 }
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
 #define COMPILER_BARRIER() asm volatile("" ::: "memory")
 #define POPCOUNT(x) (__builtin_popcount(x))
 #endif
@@ -0,0 +1,81 @@
+#include "crc32c.hpp"
+#include <string.h>
+
+// The instruction is SSE 4.2, which not every x86-64 has, so it's checked
+// for when first used rather than assumed at compile time
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+// Slicing by 8: tables[k][b] is the CRC of byte b followed by k zero bytes,
+// so eight bytes are folded in per step instead of one.
+struct CRCTables {
+    uint32_t t[8][256];
+
+    CRCTables() {
+        for (uint32_t b=0; b<256; b++) {
+            uint32_t c = b;
+            for (int k=0; k<8; k++) c = (c & 1) ? 0x82f63b78 ^ (c >> 1) : c >> 1;
+            t[0][b] = c;
+        }
+        for (int k=1; k<8; k++) {
+            for (int b=0; b<256; b++) t[k][b] = (t[k-1][b] >> 8) ^ t[0][t[k-1][b] & 0xff];
+        }
+    }
+};
+
+static const CRCTables tables;
+
+static uint32_t crc32cTables(const uint8_t *p, size_t length, uint32_t crc)
+{
+    const uint32_t (*t)[256] = tables.t;
+    while (length >= 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        length -= 8;
+    }
+    while (length--) crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSSE42(const uint8_t *p, size_t length, uint32_t crc)
+{
+#ifdef __x86_64__
+    uint64_t c = crc;
+    while (length >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)c;
+#endif
+    while (length >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        length -= 4;
+    }
+    while (length--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+static const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+uint32_t crc32c(const void *data, size_t length, uint32_t crc)
+{
+    const uint8_t *p = (const uint8_t *)data;
+#ifdef CRC32C_SSE42
+    if (have_sse42) return ~crc32cSSE42(p, length, ~crc);
+#endif
+    return ~crc32cTables(p, length, ~crc);
+}
@@ -0,0 +1,11 @@
+#ifndef INCLUDED_CRC32C_HPP
+#define INCLUDED_CRC32C_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32C (Castagnoli), which x86 has an instruction for. Pass the previous
+// result as crc to continue over more data.
+uint32_t crc32c(const void *data, size_t length, uint32_t crc = 0);
+
+#endif
@@ -1,53 +1,101 @@
 #include "datacontainer.hpp"
 #include <iostream>
 
+size_t DataContainer::index_threshold = 64;
 
-void DataContainer::setNamedItem(const std::string& name, DataItemPtr item)
+DataContainer::Index *DataContainer::getIndex()
 {
-    item->setName(name);
+    if (index) return index.get();
+    if (entries.size() < index_threshold) return 0;
+    index.reset(new Index);
+    for (size_t i=0; i<entries.size(); i++) {
+        index->named.emplace(entries[i]->getName(), i);
+        if (entries[i]->hasIndex()) index->indexed.emplace(entries[i]->getIndex(), i);
+    }
+    return index.get();
+}
 
+int DataContainer::findNamed(const std::string& name)
+{
+    if (Index *idx = getIndex()) {
+        auto i = idx->named.find(name);
+        return i == idx->named.end() ? -1 : (int)i->second;
+    }
     size_t n = entries.size();
-    for (int i=0; i<n; i++) {
-        if (entries[i]->getName() == name) {
-            entries[i] = item;
-            return;
-        }
+    for (size_t i=0; i<n; i++) {
+        if (entries[i]->getName() == name) return (int)i;
     }
-    
+    return -1;
+}
+
+int DataContainer::findIndexed(uint64_t ix)
+{
+    if (Index *idx = getIndex()) {
+        auto i = idx->indexed.find(ix);
+        return i == idx->indexed.end() ? -1 : (int)i->second;
+    }
+    size_t n = entries.size();
+    for (size_t i=0; i<n; i++) {
+        if (entries[i]->hasIndex() && entries[i]->getIndex() == ix) return (int)i;
+    }
+    return -1;
+}
+
+void DataContainer::appendItem(DataItemPtr item)
+{
+    uint32_t slot = entries.size();
     entries.push_back(item);
+    if (index) {
+        index->named.emplace(item->getName(), slot);
+        if (item->hasIndex()) index->indexed.emplace(item->getIndex(), slot);
+    }
 }
 
-DataItemPtr DataContainer::getNamedItem(const std::string& name)
+void DataContainer::setNamedItem(const std::string& name, DataItemPtr item)
 {
-    for (auto i=entries.begin(); i!=entries.end(); ++i) {
-        // std::cout << "Checking item named " << (*i)->getName() << std::endl;
-        if ((*i)->getName() == name) return *i;
+    item->setName(name);
+    int i = findNamed(name);
+    if (i < 0) {
+        appendItem(item);
+        return;
     }
-    // std::cout << "Could not find " << name << std::endl;
-    return 0;
+    // The index may have this slot under the old item's index too
+    if (index && (entries[i]->hasIndex() || item->hasIndex())) index.reset();
+    entries[i] = item;
+}
+
+void DataContainer::removeNamedItem(const std::string& name)
+{
+    int i = findNamed(name);
+    if (i < 0) return;
+    entries.erase(entries.begin() + i);
+    // Everything after it moved down
+    index.reset();
+}
+
+DataItemPtr DataContainer::getNamedItem(const std::string& name)
+{
+    int i = findNamed(name);
+    return i < 0 ? DataItemPtr() : entries[i];
 }
 
 void DataContainer::setIndexedItem(uint64_t ix, DataItemPtr item)
 {
     item->setIndex(ix);
-    
-    size_t n = entries.size();
-    for (int i=0; i<n; i++) {
-        if (entries[i]->hasIndex() && entries[i]->getIndex() == ix) {
-            entries[i] = item;
-            return;
-        }
+    int i = findIndexed(ix);
+    if (i < 0) {
+        appendItem(item);
+        return;
     }
-    
-    entries.push_back(item);
+    // Likewise for names
+    if (index && entries[i]->getName() != item->getName()) index.reset();
+    entries[i] = item;
 }
 
 DataItemPtr DataContainer::getIndexedItem(uint64_t ix)
 {
-    for (auto i=entries.begin(); i!=entries.end(); ++i) {
-        if ((*i)->hasIndex() && (*i)->getIndex() == ix) return *i;
-    }
-    return 0;
+    int i = findIndexed(ix);
+    return i < 0 ? DataItemPtr() : entries[i];
 }
 
 
@@ -103,74 +151,53 @@ static inline int arraySizeTag(uint64_t size) {
     return DataItem::HUGE_ARR;
 }
 
-static inline void push_bytes(std::deque<char>& data, char *start, size_t len)
+// Everything but a container's contents, for DataItem and ArenaItem alike
+static void packItem(ByteWriter& data, int item_type, std::string_view name, bool indexed, uint64_t index,
+    uint64_t array_count, const void *value)
 {
-    // XXX Could fix this to work with big endian
-    data.insert(std::end(data), start, start+len);
-}
-
-void DataItem::pack(std::deque<char>& data)
-{
-    uint64_t offset = 1;
     char tag_byte = item_type;
 
-    if (name.size()) tag_byte |= NAMED;
-    if (indexed) tag_byte |= INDEXED;
+    if (name.size()) tag_byte |= DataItem::NAMED;
+    if (indexed) tag_byte |= DataItem::INDEXED;
     if (array_count) {
         tag_byte |= arraySizeTag(array_count);
     }
-    data.push_back(tag_byte);
+    data.put(tag_byte);
     
     if (name.size()) {
-        data.push_back((char)name.size());
-        data.insert(std::end(data), std::begin(name), std::end(name));
+        data.put((char)name.size());
+        data.put(name.data(), name.size());
     }
     
+    // XXX Could fix this to work with big endian
     if (indexed) {
-        push_bytes(data, (char *)&index, 8);
+        data.put(&index, 8);
     }
     
-    if (item_type == CONTAINER) {
-        DataContainerPtr container = getContainer();
-        container->pack(data);
+    if (item_type == DataItem::CONTAINER) return;
+    int item_size = item_byte_sizes[item_type];
+    if (array_count == 0) {
+        data.put(value, item_size);
     } else {
-        if (array_count == 0) {
-            int item_size = item_byte_sizes[item_type];
-            push_bytes(data, (char *)&data64, item_size);
-        } else {
-            int item_size = item_byte_sizes[item_type];
-            int size_size = arraySizeSize(array_count);
-            push_bytes(data, (char *)&array_count, size_size);
-            uint64_t byte_count = array_count * item_size;
-            push_bytes(data, ptr, byte_count);
-        }
+        int size_size = arraySizeSize(array_count);
+        data.put(&array_count, size_size);
+        uint64_t byte_count = array_count * item_size;
+        data.put(value, byte_count);
     }
 }
 
-static inline char next_byte(std::deque<char>& data)
+void DataItem::pack(ByteWriter& data)
 {
-    char b = data.front();
-    data.pop_front();
-    return b;
-}
-
-static void pop_string(std::deque<char>& data, uint64_t len, std::string& str)
-{
-    str.resize(len);
-    for (int i=0; i<len; i++) {
-        str[i] = next_byte(data);
+    packItem(data, item_type, name, indexed, index, array_count, array_count ? (const void *)ptr : (const void *)&data64);
+    if (item_type == CONTAINER) {
+        DataContainerPtr container = getContainer();
+        container->pack(data);
     }
 }
 
-static void pop_bytes(std::deque<char>& data, uint64_t len, char *mem)
+DataItemPtr DataItem::unpack(ByteReader& data)
 {
-    std::copy(data.begin(), data.begin() + len, mem);
-    data.erase(data.begin(), data.begin() + len);
-}
-
-DataItemPtr DataItem::unpack(std::deque<char>& data)
-{
-    unsigned char tag_byte = next_byte(data);
+    unsigned char tag_byte = data.get();
     // std::cout << "tag byte: " << (int)tag_byte << std::endl;
     unsigned char item_type = tag_byte & TYPE_MASK;
     int size_size = tagSizeSize(tag_byte);
@@ -181,33 +208,41 @@ DataItemPtr DataItem::unpack(std::deque<char>& data)
     // std::cout << "item_type:" << (int)item_type << " named=" << (!!(tag_byte&NAMED)) << " indexed=" << (!!(tag_byte&INDEXED)) << std::endl;
     
     if (tag_byte & NAMED) {
-        int str_size = next_byte(data);
-        pop_string(data, str_size, item->name);
+        int str_size = (unsigned char)data.get();
+        const char *str = data.take(str_size);
+        if (str) item->name.assign(str, str_size);
         // std::cout << "name=" << item->name << std::endl;
     }
     
     if (tag_byte & INDEXED) {
-        pop_bytes(data, sizeof(uint64_t), (char *)&item->index);
+        data.get(&item->index, sizeof(uint64_t));
         item->indexed = true;
     }
     
     if (item_type == CONTAINER) {
         // std::cout << "Going to unpack contaner\n";
         item->container = DataContainer::unpack(data);
+    } else if (item_type > DOUBLE) {
+        // Not a value type
+        data.fail();
     } else {
         if (size_size) {            
             uint64_t array_count = 0;
-            pop_bytes(data, size_size, (char *)&array_count);
-            item->array_count = array_count;
+            data.get(&array_count, size_size);
             int item_size = item_byte_sizes[item_type];
+            if (array_count > data.remaining() / item_size) data.fail();
             uint64_t byte_count = array_count * item_size;
             // std::cout << "byte count " << byte_count << std::endl;
-            item->ptr = new char[byte_count];
-            pop_bytes(data, byte_count, item->ptr);
+            const char *src = data.take(byte_count);
+            if (src && array_count) {
+                item->array_count = array_count;
+                item->ptr = new char[byte_count];
+                memcpy(item->ptr, src, byte_count);
+            }
         } else {
             int item_size = item_byte_sizes[item_type];
             item->data64 = 0;
-            pop_bytes(data, item_size, (char *)&(item->data64));
+            data.get(&item->data64, item_size);
         }
     }
     
@@ -215,14 +250,13 @@ DataItemPtr DataItem::unpack(std::deque<char>& data)
 }
 
 
-DataContainerPtr DataContainer::unpack(std::deque<char>& data)
+DataContainerPtr DataContainer::unpack(ByteReader& data)
 {
     DataContainerPtr dc(new DataContainer);
     
-    while (data.size()>0) {
-        char tag = data.front();
-        if (tag == DataItem::CONTAINER_END) {
-            data.pop_front();
+    while (data.ok() && !data.atEnd()) {
+        if (data.peek() == DataItem::CONTAINER_END) {
+            data.get();
             // std::cout << "Returning container with " << dc->numItems() << " at " << ((void*)dc.get()) << std::endl;
             return dc;
         }
@@ -230,20 +264,137 @@ DataContainerPtr DataContainer::unpack(std::deque<char>& data)
         // std::cout << "Container unpacking item " << dc->numItems() << std::endl;
         DataItemPtr di = DataItem::unpack(data);
         // std::cout << "Added item named " << di->getName() << std::endl;
-        dc->entries.push_back(di);
+        if (data.ok()) dc->appendItem(di);
     }
     
     // std::cout << "Returning container with " << dc->numItems() << std::endl;
     return dc;
 }
 
-void DataContainer::pack(std::deque<char>& data)
+bool DataItemView::next(ByteReader& data, DataItemView& item)
+{
+    if (!data.ok() || data.atEnd()) return false;
+    unsigned char tag_byte = data.get();
+    if (tag_byte == DataItem::CONTAINER_END) return false;
+    
+    item.type = tag_byte & DataItem::TYPE_MASK;
+    item.name = std::string_view();
+    item.indexed = false;
+    item.index = 0;
+    item.array_count = 0;
+    
+    if (tag_byte & DataItem::NAMED) {
+        int str_size = (unsigned char)data.get();
+        const char *str = data.take(str_size);
+        if (str) item.name = std::string_view(str, str_size);
+    }
+    
+    if (tag_byte & DataItem::INDEXED) {
+        data.get(&item.index, sizeof(uint64_t));
+        item.indexed = true;
+    }
+    
+    if (item.type == DataItem::CONTAINER) {
+        // Step over the contents, including nested containers
+        item.data = data.position();
+        DataItemView inner;
+        for (;;) {
+            if (data.atEnd()) data.fail();
+            if (!next(data, inner)) break;
+        }
+        item.byte_count = data.position() - item.data;
+        return data.ok();
+    } else if (item.type > DataItem::DOUBLE) {
+        data.fail();
+        return false;
+    }
+    
+    int item_size = item_byte_sizes[item.type];
+    int size_size = tagSizeSize(tag_byte);
+    if (size_size) {
+        data.get(&item.array_count, size_size);
+        if (item.array_count > data.remaining() / item_size) {
+            data.fail();
+            return false;
+        }
+        item.byte_count = item.array_count * item_size;
+    } else {
+        item.byte_count = item_size;
+    }
+    item.data = data.take(item.byte_count);
+    return data.ok();
+}
+
+void DataContainer::pack(ByteWriter& data)
 {
     for (auto i=entries.begin(); i!=entries.end(); ++i) {
         DataItemPtr di = *i;
         di->pack(data);
     }
-    data.push_back(DataItem::CONTAINER_END);
+    data.put(DataItem::CONTAINER_END);
+}
+
+
+ArenaItem *ArenaContainer::append(int type)
+{
+    ArenaItem *di = arena.make<ArenaItem>();
+    di->item_type = type;
+    if (last) {
+        last->next = di;
+    } else {
+        first = di;
+    }
+    last = di;
+    count++;
+    return di;
+}
+
+ArenaItem *ArenaContainer::appendArray(int type, size_t item_size, size_t cnt, const void *p)
+{
+    ArenaItem *di = append(type);
+    if (!cnt) return di;
+    di->array_count = cnt;
+    di->ptr = (char *)arena.alloc(cnt * item_size, item_size);
+    if (p) {
+        memcpy(di->ptr, p, cnt * item_size);
+    } else {
+        memset(di->ptr, 0, cnt * item_size);
+    }
+    return di;
+}
+
+ArenaItem *ArenaContainer::addContainer()
+{
+    ArenaItem *di = append(DataItem::CONTAINER);
+    di->container = make(arena);
+    return di;
+}
+
+ArenaItem *ArenaContainer::addContainer(const char *packed, size_t length)
+{
+    ArenaItem *di = append(DataItem::CONTAINER);
+    di->packed = packed;
+    di->packed_size = length;
+    return di;
+}
+
+void ArenaItem::pack(ByteWriter& data)
+{
+    packItem(data, item_type, name, indexed, index, array_count, array_count ? (const void *)ptr : (const void *)&data64);
+    if (item_type != DataItem::CONTAINER) return;
+    if (packed) {
+        data.put(packed, packed_size);
+    } else if (container) {
+        container->pack(data);
+    } else {
+        data.put(DataItem::CONTAINER_END);
+    }
+}
+
+void ArenaContainer::pack(ByteWriter& data)
+{
+    for (ArenaItem *di = first; di; di = di->next) di->pack(data);
+    data.put(DataItem::CONTAINER_END);
 }
 
 
@@ -302,12 +453,13 @@ int main()
     
     dc->debug();
     
-    std::deque<char> serial;
+    ByteWriter serial;
     dc->pack(serial);
-    for (int i=0; i<serial.size(); i++) printf("%02x ", 255 & serial[i]);
+    for (int i=0; i<serial.size(); i++) printf("%02x ", 255 & serial.data()[i]);
     printf("\n");
     
-    DataContainerPtr dc4 = DataContainer::unpack(serial);
+    ByteReader reader(serial.data(), serial.size());
+    DataContainerPtr dc4 = DataContainer::unpack(reader);
     dc4->debug();
     
     return 0;
@@ -5,12 +5,81 @@
 #include <string>
 #include <string_view>
 #include <vector>
-#include <deque>
 #include <memory>
+#include <unordered_map>
+#include "memoryarena.hpp"
 
 class DataContainer;
 class DataItem;
 
+// Growable buffer that items are packed into
+class ByteWriter {
+private:
+    std::vector<char> bytes;
+    
+public:
+    void put(char c) { bytes.push_back(c); }
+    void put(const void *p, size_t len) {
+        const char *c = (const char *)p;
+        bytes.insert(bytes.end(), c, c + len);
+    }
+    // Room for len more bytes, to be filled in before the next put
+    char *extend(size_t len) {
+        bytes.resize(bytes.size() + len);
+        return bytes.data() + bytes.size() - len;
+    }
+    
+    const char *data() const { return bytes.data(); }
+    size_t size() const { return bytes.size(); }
+    // Keeps the capacity for the next use
+    void clear() { bytes.clear(); }
+};
+
+// Cursor over packed bytes owned by someone else. Reading past the end
+// fails instead of running off it; after that ok() is false and every read
+// gives zeros.
+class ByteReader {
+private:
+    const char *pos, *end;
+    bool failed;
+    
+public:
+    ByteReader(const char *data, size_t len) : pos(data), end(data + len), failed(false) {}
+    
+    bool ok() const { return !failed; }
+    void fail() { failed = true; }
+    size_t remaining() const { return end - pos; }
+    const char *position() const { return pos; }
+    bool atEnd() const { return pos == end; }
+    
+    // Next byte without consuming it, or -1 at the end
+    int peek() const { return pos < end ? (unsigned char)*pos : -1; }
+    char get() {
+        if (pos < end) return *pos++;
+        failed = true;
+        return 0;
+    }
+    bool get(void *p, size_t len) {
+        const char *src = take(len);
+        if (src) {
+            memcpy(p, src, len);
+        } else {
+            memset(p, 0, len);
+        }
+        return src != 0;
+    }
+    // The next len bytes where they are, or null if there aren't that many
+    const char *take(size_t len) {
+        if (failed || len > remaining()) {
+            failed = true;
+            return 0;
+        }
+        const char *p = pos;
+        pos += len;
+        return p;
+    }
+};
+
 typedef std::shared_ptr<DataContainer> DataContainerPtr;
 typedef std::shared_ptr<DataItem> DataItemPtr;
 
@@ -133,46 +202,101 @@ public:
     
     DataContainerPtr getContainer() { return container; }
     
-    static DataItemPtr unpack(std::deque<char>& data);
-    void pack(std::deque<char>& data);
+    static DataItemPtr unpack(ByteReader& data);
+    void pack(ByteWriter& data);
     
     void debug(int level);
 };
 
+// A packed item read where it lies, without copying anything out of the
+// buffer. Only valid while the buffer is.
+struct DataItemView {
+    int type;
+    std::string_view name;
+    bool indexed;
+    uint64_t index;
+    uint64_t array_count;
+    // Array contents or the scalar's bytes. For a container, everything up
+    // to and including its CONTAINER_END.
+    const char *data;
+    size_t byte_count;
+    
+    // type is -1 until an item is read into it
+    DataItemView() : type(-1), indexed(false), index(0), array_count(0), data(0), byte_count(0) {}
+    
+    int16_t getInt16() const { int16_t v = 0; if (byte_count >= 2) memcpy(&v, data, 2); return v; }
+    // For a container
+    ByteReader contents() const { return ByteReader(data, byte_count); }
+    
+    // Read the next item of a container into item. Returns false at the end
+    // of the container, after consuming its CONTAINER_END, or if the data is
+    // bad (check data.ok()).
+    static bool next(ByteReader& data, DataItemView& item);
+};
+
+// Items are looked up by scanning, until there are index_threshold of them.
+// After that a hash index from names and indices to positions is built on
+// the next lookup and kept up to date, or dropped when entries move and
+// built again when next needed. Where names or indices repeat, the first
+// wins either way. The packed format doesn't change.
+//
+// An item should be in one container at a time: renaming it through another
+// leaves this one's index out of date.
 class DataContainer {
+public:
+    // 64. Benchmarks raise it to measure plain scanning.
+    static size_t index_threshold;
+    
 private:
+    struct Index {
+        std::unordered_map<std::string, uint32_t> named;
+        std::unordered_map<uint64_t, uint32_t> indexed;
+    };
+    
     std::vector<DataItemPtr> entries;
+    std::unique_ptr<Index> index;
     // int64_t packed_length;
     
+    Index *getIndex();
+    int findNamed(const std::string& name);
+    int findIndexed(uint64_t ix);
+    void appendItem(DataItemPtr item);
+    
 protected:
     DataContainer() {}
 public:
     ~DataContainer() {}
     
-    void addInt8 (int8_t  i)   { entries.push_back(DataItem::makeInt8(i)); }
-    void addInt16(int16_t i)   { entries.push_back(DataItem::makeInt16(i)); }
-    void addInt32(int32_t i)   { entries.push_back(DataItem::makeInt32(i)); }
-    void addInt64(int64_t i)   { entries.push_back(DataItem::makeInt64(i)); }
-    void addFloat(float f)     { entries.push_back(DataItem::makeFloat(f)); }
-    void addDouble(double d)   { entries.push_back(DataItem::makeDouble(d)); }
-    void addString(const std::string& s) { entries.push_back(DataItem::makeString(s)); }
+    void addInt8 (int8_t  i)   { appendItem(DataItem::makeInt8(i)); }
+    void addInt16(int16_t i)   { appendItem(DataItem::makeInt16(i)); }
+    void addInt32(int32_t i)   { appendItem(DataItem::makeInt32(i)); }
+    void addInt64(int64_t i)   { appendItem(DataItem::makeInt64(i)); }
+    void addFloat(float f)     { appendItem(DataItem::makeFloat(f)); }
+    void addDouble(double d)   { appendItem(DataItem::makeDouble(d)); }
+    void addString(const std::string& s) { appendItem(DataItem::makeString(s)); }
     void addContainer(DataContainerPtr dc) {
-        entries.push_back(DataItem::wrapContainer(dc));
+        appendItem(DataItem::wrapContainer(dc));
     }
     
     size_t numItems() { return entries.size(); }
     
-    void addItem(DataItemPtr i)  { entries.push_back(i); }
-    void setItem(int container_index, DataItemPtr i)  { entries[container_index] = i; }
+    void addItem(DataItemPtr i)  { appendItem(i); }
+    void setItem(int container_index, DataItemPtr i)  {
+        entries[container_index] = i;
+        index.reset();
+    }
     void setNamedItem(const std::string& name, DataItemPtr i);
     void setIndexedItem(uint64_t index, DataItemPtr i);
+    void removeNamedItem(const std::string& name);
     
     DataItemPtr getItem(int container_index) { return entries[container_index]; }
     DataItemPtr getNamedItem(const std::string& name);
     DataItemPtr getIndexedItem(uint64_t index);
     
-    static DataContainerPtr unpack(std::deque<char>& data);
-    void pack(std::deque<char>& data);
+    // Check data.ok() afterwards: a truncated or corrupt buffer gives back
+    // whatever items could be read
+    static DataContainerPtr unpack(ByteReader& data);
+    void pack(ByteWriter& data);
     
     void debug(int level=0);
     
@@ -181,4 +305,85 @@ public:
     }
 };
 
+class ArenaContainer;
+
+// Item of an ArenaContainer. Names aren't copied, so they have to last
+// until the tree is packed (see MemoryArena::copyString).
+struct ArenaItem {
+    unsigned char item_type;
+    bool indexed;
+    std::string_view name;
+    uint64_t index;
+    uint64_t array_count;
+    union {
+        int8_t data8;
+        int16_t data16;
+        int32_t data32;
+        int64_t data64;
+        float fdata;
+        double ddata;
+        char *ptr;
+    };
+    ArenaContainer *container;
+    // Contents packed already, used in place of container if set
+    const char *packed;
+    size_t packed_size;
+    ArenaItem *next;
+    
+    void setName(std::string_view n) { name = n; }
+    void setIndex(uint64_t ix) { index = ix; indexed = true; }
+    
+    int8_t  *getInt8Array()  { return (int8_t*)ptr; }
+    int16_t *getInt16Array() { return (int16_t*)ptr; }
+    
+    void pack(ByteWriter& data);
+};
+
+/*
+A container tree for packing once and throwing away, such as a chunk being
+saved. It packs to the same bytes as the DataContainer tree it stands for,
+but items, array contents and nested containers all come from a
+MemoryArena, so building one doesn't touch the heap and it's freed by
+resetting the arena. Items are only appended; there's no lookup.
+*/
+class ArenaContainer {
+private:
+    MemoryArena& arena;
+    ArenaItem *first, *last;
+    size_t count;
+    
+    ArenaItem *append(int type);
+    ArenaItem *appendArray(int type, size_t item_size, size_t cnt, const void *p);
+    
+public:
+    ArenaContainer(MemoryArena& a) : arena(a), first(0), last(0), count(0) {}
+    static ArenaContainer *make(MemoryArena& a) { return new (a.alloc(sizeof(ArenaContainer), alignof(ArenaContainer))) ArenaContainer(a); }
+    
+    ArenaItem *addInt8 (int8_t  i) { ArenaItem *di = append(DataItem::INT8);   di->data8 =  i; return di; }
+    ArenaItem *addInt16(int16_t i) { ArenaItem *di = append(DataItem::INT16);  di->data16 = i; return di; }
+    ArenaItem *addInt32(int32_t i) { ArenaItem *di = append(DataItem::INT32);  di->data32 = i; return di; }
+    ArenaItem *addInt64(int64_t i) { ArenaItem *di = append(DataItem::INT64);  di->data64 = i; return di; }
+    ArenaItem *addFloat(float f)   { ArenaItem *di = append(DataItem::FLOAT);  di->fdata =  f; return di; }
+    ArenaItem *addDouble(double d) { ArenaItem *di = append(DataItem::DOUBLE); di->ddata =  d; return di; }
+    
+    // Contents are copied, or zeroed without p
+    ArenaItem *addInt8Array  (size_t cnt, const int8_t  *p=0) { return appendArray(DataItem::INT8,   1, cnt, p); }
+    ArenaItem *addInt16Array (size_t cnt, const int16_t *p=0) { return appendArray(DataItem::INT16,  2, cnt, p); }
+    ArenaItem *addInt32Array (size_t cnt, const int32_t *p=0) { return appendArray(DataItem::INT32,  4, cnt, p); }
+    ArenaItem *addInt64Array (size_t cnt, const int64_t *p=0) { return appendArray(DataItem::INT64,  8, cnt, p); }
+    ArenaItem *addFloatArray (size_t cnt, const float   *p=0) { return appendArray(DataItem::FLOAT,  4, cnt, p); }
+    ArenaItem *addDoubleArray(size_t cnt, const double  *p=0) { return appendArray(DataItem::DOUBLE, 8, cnt, p); }
+    ArenaItem *addString(std::string_view s) { return addInt8Array(s.size(), (const int8_t *)s.data()); }
+    
+    // A new empty container, as item->container
+    ArenaItem *addContainer();
+    // One packed already by DataContainer::pack, up to and including its
+    // CONTAINER_END. The bytes aren't copied.
+    ArenaItem *addContainer(const char *packed, size_t length);
+    
+    size_t numItems() { return count; }
+    
+    void pack(ByteWriter& data);
+};
+
 #endif
@@ -4,6 +4,92 @@
 #include "world.hpp"
 #include "spline.hpp"
 #include <random>
+#include <mutex>
+#include <unordered_map>
+#include <string.h>
+
+// What a soft dirt mesh is made from: the surface heights in 1/128ths of a
+// block, the same resolution heights_equal compares at, and the seed for
+// the surface noise
+struct DirtShape {
+    int16_t height[17][17];
+    uint32_t seed;
+    
+    bool operator==(const DirtShape& other) const {
+        return seed == other.seed && !memcmp(height, other.height, sizeof(height));
+    }
+};
+
+struct DirtShapeHash {
+    size_t operator()(const DirtShape& shape) const {
+        uint64_t h = 14695981039346656037ULL ^ shape.seed;
+        const int16_t *p = &shape.height[0][0];
+        for (int i=0; i<17*17; i++) {
+            h ^= (uint16_t)p[i];
+            h *= 1099511628211ULL;
+        }
+        return (size_t)h;
+    }
+};
+
+/*
+Soft dirt meshes interned by shape. A field of dirt has only a few distinct
+shapes, so most blocks share a mesh with their neighbors instead of each
+holding their own copy. Only weak references are kept here, so a mesh goes
+away when the last block using it does; dead entries are swept out as the
+table grows. Repaints can come from any thread.
+*/
+class DirtMeshLibrary {
+private:
+    std::unordered_map<DirtShape, std::weak_ptr<Mesh>, DirtShapeHash> meshes;
+    std::mutex library_mutex;
+    size_t sweep_at;
+    
+    void sweep() {
+        for (auto i=meshes.begin(); i!=meshes.end(); ) {
+            if (i->second.expired()) {
+                i = meshes.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        sweep_at = std::max((size_t)1024, meshes.size() * 2);
+    }
+    
+public:
+    static DirtMeshLibrary instance;
+    
+    size_t hits, misses;
+    
+    DirtMeshLibrary() : sweep_at(1024), hits(0), misses(0) {}
+    
+    MeshPtr find(const DirtShape& shape) {
+        std::unique_lock<std::mutex> lock(library_mutex);
+        auto i = meshes.find(shape);
+        MeshPtr mesh;
+        if (i != meshes.end()) mesh = i->second.lock();
+        if (mesh) {
+            hits++;
+        } else {
+            misses++;
+        }
+        return mesh;
+    }
+    
+    // Returns the mesh to use, which is an earlier one if another thread
+    // got there first
+    MeshPtr add(const DirtShape& shape, MeshPtr mesh) {
+        std::unique_lock<std::mutex> lock(library_mutex);
+        std::weak_ptr<Mesh>& entry(meshes[shape]);
+        MeshPtr existing = entry.lock();
+        if (existing) return existing;
+        entry = mesh;
+        if (meshes.size() >= sweep_at) sweep();
+        return mesh;
+    }
+};
+
+DirtMeshLibrary DirtMeshLibrary::instance;
 
 class DynamicDirtBlock : public BlockType {
 private:
@@ -29,7 +115,7 @@ public:
 
     virtual const std::string& getName();
     
-    float *getHeights(Block *block);
+    MeshPtr buildMesh(const DirtShape& shape);
     
     bool isSoftDirt(BlockPtr n);
     bool isSolidBlock(BlockPtr n);
@@ -61,30 +147,19 @@ void DynamicDirtBlock::placeEvent(Block *block)
 
 void DynamicDirtBlock::breakEvent(Block *block) {}
 
-static bool heights_equal(float *p, float *q)
+static bool heights_equal(const DirtShape& shape, const HeightField *saved)
 {
+    const int16_t *p = &shape.height[0][0];
     for (int i=0; i<17*17; i++) {
-        if (round(p[i]*128) != round(q[i]*128)) return false;
+        if (HeightField::encode(p[i]) != saved->code[i]) return false;
     }
     return true;
 }
 
-
-float *DynamicDirtBlock::getHeights(Block *block)
+static void save_heights(const DirtShape& shape, HeightField *saved)
 {
-    DataContainerPtr dcp = block->getData(true);
-    float *saved_height = 0;
-    DataItemPtr sh = dcp->getNamedItem("heights");
-    if (!sh || sh->getArrayCount() != 17*17) {
-        sh = DataItem::makeFloatArray(17*17);
-        dcp->setNamedItem("heights", sh);
-        saved_height = sh->getFloatArray();
-        for (int i=0; i<17*17; i++) saved_height[i] = -1;
-        block->markDataModified();
-    } else {
-        saved_height = sh->getFloatArray();
-    }
-    return saved_height;
+    const int16_t *p = &shape.height[0][0];
+    for (int i=0; i<17*17; i++) saved->code[i] = HeightField::encode(p[i]);
 }
 
 static void getSurroundings(const BlockPos& pos, BlockPtr *neigh)
@@ -124,6 +199,8 @@ void DynamicDirtBlock::updateEvent(Block *block)
 
 constexpr double vert = 5;
 constexpr double frac = 1.0 / 16.0;
+// Different surface noise patterns. Fewer means more blocks share a mesh.
+constexpr int noise_variants = 16;
 
 void DynamicDirtBlock::repaintEvent(Block *block)
 {
@@ -135,7 +212,7 @@ void DynamicDirtBlock::repaintEvent(Block *block)
         if (block->getMesh() != block->getDefaultMesh()) {
             // Surrounded on all sides: use default
             block->setMesh(0);
-            block->setData(0);
+            block->clearHeights();
             World::instance.repaintSurroundingBlocks(block->pos);
         }
         return;
@@ -500,36 +577,52 @@ void DynamicDirtBlock::repaintEvent(Block *block)
     }
     
     s.compute_coefficients();
-    unsigned int seed = block->pos.X ^ block->pos.Y ^ block->pos.Z;
-    std::minstd_rand generator (seed);
-    std::normal_distribution<double> rnd(0,1);
+    DirtShape shape;
+    shape.seed = (block->pos.X ^ block->pos.Y ^ block->pos.Z) & (noise_variants - 1);
+    
+    static const SplineGrid grid(17);
+    float heights[17 * SplineGrid::padded(17)];
+    s.compute_grid(grid, heights);
+    for (int zi=0; zi<=16; zi++) {
+        const float *row = heights + zi * grid.stride;
+        for (int xi=0; xi<=16; xi++) {
+            shape.height[zi][xi] = (int16_t)round(row[xi] * 128);
+        }
+    }
     
-    // std::cout << rnd(generator) << std::endl;
-    // std::minstd_rand generator2 (seed);
-    // // generator2.seed(seed);
-    // std::normal_distribution<double> rnd2(0,1);
-    // std::cout << rnd2(generator2) << std::endl;
+    HeightField *saved_height = block->getHeights(true);
+    if (block->getMesh() != block->getDefaultMesh() && heights_equal(shape, saved_height)) {
+        return;
+    }
     
+    MeshPtr newMesh = DirtMeshLibrary::instance.find(shape);
+    if (!newMesh) newMesh = DirtMeshLibrary::instance.add(shape, buildMesh(shape));
+    
+    save_heights(shape, saved_height);
+    // block->markDataModified(); // Not very important that the chunk be saved over this
+    block->setMesh(newMesh);
+    World::instance.repaintSurroundingBlocks(block->pos);    
+}
+
+// Everything here comes from the shape, so blocks with the same shape can
+// share the result
+MeshPtr DynamicDirtBlock::buildMesh(const DirtShape& shape)
+{
+    std::minstd_rand generator (shape.seed);
+    std::normal_distribution<double> rnd(0,1);
     
-    float height[17][17];
     float height2[17][17];
     for (int zi=0; zi<=16; zi++) {
         for (int xi=0; xi<=16; xi++) {
-            height[zi][xi] = s.compute(xi * frac, zi * frac);
-            height2[zi][xi] = height[zi][xi] + rnd(generator) / 64;
+            int h = shape.height[zi][xi];
+            height2[zi][xi] = h / 128.0f + rnd(generator) / 64;
             if (height2[zi][xi]>1) height2[zi][xi]=1;
-            if (height[zi][xi]==1) height2[zi][xi]=1;
+            if (h==128) height2[zi][xi]=1;
             if (height2[zi][xi]<0) height2[zi][xi]=0;
-            if (height[zi][xi]==0) height2[zi][xi]=0;
+            if (h==0) height2[zi][xi]=0;
         }
     }
     
-    float *saved_height = getHeights(block);
-    if (block->getMesh() != block->getDefaultMesh() && heights_equal((float *)height, saved_height)) {
-        return;
-    }
-    
-    // std::cout << "Recomputing\n";
     // Build new mesh
     MeshPtr newMesh = Mesh::makeMesh();
     newMesh->setTexture(default_mesh->getTextureIndex());
@@ -553,21 +646,16 @@ void DynamicDirtBlock::repaintEvent(Block *block)
             
             // a = b = c = d = max_h;
             
-            f = newMesh->addFace();
-            f->addVertex(xi*frac, a, zi*frac);
-            f->addVertex(xi*frac, c, (zi+1)*frac);
-            f->addVertex((xi+1)*frac, b, zi*frac);
-            f->addTexCoord(xi*frac, 1 - zi*frac);
-            f->addTexCoord(xi*frac, 1 - (zi+1)*frac);
-            f->addTexCoord((xi+1)*frac, 1 - zi*frac);
-    
+            // One quad, split along the c-b diagonal
             f = newMesh->addFace();
             f->addVertex(xi*frac, c, (zi+1)*frac);
             f->addVertex((xi+1)*frac, d, (zi+1)*frac);
             f->addVertex((xi+1)*frac, b, zi*frac);
+            f->addVertex(xi*frac, a, zi*frac);
             f->addTexCoord(xi*frac, 1 - (zi+1)*frac);
             f->addTexCoord((xi+1)*frac, 1 - (zi+1)*frac);
             f->addTexCoord((xi+1)*frac, 1 - zi*frac);
+            f->addTexCoord(xi*frac, 1 - zi*frac);
         }
     }
     
@@ -643,10 +731,7 @@ void DynamicDirtBlock::repaintEvent(Block *block)
         }
     }    
     
-    memcpy(saved_height, height, sizeof(float) * 17*17);
-    // block->markDataModified(); // Not very important that the chunk be saved over this
-    block->setMesh(newMesh);
-    World::instance.repaintSurroundingBlocks(block->pos);    
+    return newMesh;
 }
 
 
@@ -0,0 +1,205 @@
+#include "editjournal.hpp"
+#include "filelocator.hpp"
+#include "datacontainer.hpp"
+#include "crc32c.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__APPLE__) || defined(__linux__)
+#include <unistd.h>
+#endif
+
+// A file is the magic number and version, then records of
+//     uint32 length, uint32 CRC of what follows,
+//     int32 X, Y, Z, uint8 rotation, uint8 name length, name
+// Record numbers aren't stored; they follow from the file and the order.
+
+EditJournal EditJournal::instance;
+
+EditJournal::EditJournal() : file(0), sequence(0), file_size(0), file_records(0), failed(false),
+    enabled(true), sync(false), checkpoint_bytes(1 << 20) {}
+
+EditJournal::~EditJournal()
+{
+    close();
+}
+
+std::string EditJournal::fileName(uint64_t seq)
+{
+    return FileLocator::instance.chunk("journal(" + std::to_string(seq) + ")");
+}
+
+void EditJournal::listFiles(std::vector<uint64_t>& seqs)
+{
+    seqs.clear();
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(FileLocator::instance.chunk(""), ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 8, "journal(") || name.back() != ')') continue;
+        seqs.push_back(strtoull(name.c_str() + 8, 0, 10));
+    }
+    std::sort(seqs.begin(), seqs.end());
+}
+
+bool EditJournal::readFile(uint64_t seq, std::vector<Edit>& edits)
+{
+    std::ifstream rf(fileName(seq), std::ios::binary);
+    if (!rf.good()) return false;
+    std::vector<char> bytes((std::istreambuf_iterator<char>(rf)), std::istreambuf_iterator<char>());
+
+    ByteReader in(bytes.data(), bytes.size());
+    uint32_t header[2];
+    in.get(header, sizeof(header));
+    if (!in.ok() || header[0] != magic || header[1] != version) {
+        std::cout << "Bad journal file " << seq << std::endl;
+        return false;
+    }
+
+    uint32_t index = 0;
+    while (in.remaining() >= 8) {
+        uint32_t length, crc;
+        in.get(&length, 4);
+        in.get(&crc, 4);
+        const char *record = in.take(length);
+        // What a crash cut off, and anything after it, is lost
+        if (!record || crc32c(record, length) != crc) {
+            std::cout << "Journal file " << seq << " ends in a damaged record" << std::endl;
+            return true;
+        }
+
+        index++;
+        ByteReader r(record, length);
+        int32_t xyz[3];
+        Edit edit;
+        r.get(xyz, sizeof(xyz));
+        edit.rotation = r.get();
+        uint8_t name_length = r.get();
+        const char *name = r.take(name_length);
+        if (!name) continue;
+        edit.pos = BlockPos(xyz[0], xyz[1], xyz[2]);
+        edit.name.assign(name, name_length);
+        edit.record = recordNumber(seq, index);
+        edits.push_back(edit);
+    }
+    return true;
+}
+
+bool EditJournal::openNextUnlocked()
+{
+    if (failed) return false;
+    if (!sequence) {
+        std::vector<uint64_t> seqs;
+        listFiles(seqs);
+        if (!seqs.empty()) sequence = seqs.back();
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(FileLocator::instance.chunk(""), ec);
+    std::string fname = fileName(++sequence);
+    file = fopen(fname.c_str(), "wb");
+    uint32_t header[2] = { magic, version };
+    if (!file || fwrite(header, sizeof(header), 1, file) != 1 || fflush(file)) {
+        // Chunks will just be saved the usual way
+        std::cout << "Unable to write journal " << fname << std::endl;
+        failed = true;
+        close();
+        return false;
+    }
+    file_size = sizeof(header);
+    file_records = 0;
+    return true;
+}
+
+void EditJournal::recover(std::vector<Edit>& edits)
+{
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    std::vector<uint64_t> seqs;
+    listFiles(seqs);
+    for (uint64_t seq : seqs) {
+        if (file && seq >= sequence) break;
+        readFile(seq, edits);
+        if (seq > sequence) sequence = seq;
+    }
+}
+
+uint64_t EditJournal::recordBlock(const BlockPos& pos, const std::string& name, int rotation)
+{
+    if (!enabled || name.size() > 255) return 0;
+
+    char record[8 + 14 + 255];
+    int32_t xyz[3] = { pos.X, pos.Y, pos.Z };
+    uint32_t length = sizeof(xyz) + 2 + name.size();
+    memcpy(record + 8, xyz, sizeof(xyz));
+    record[20] = (char)rotation;
+    record[21] = (char)name.size();
+    memcpy(record + 22, name.data(), name.size());
+    uint32_t crc = crc32c(record + 8, length);
+    memcpy(record, &length, 4);
+    memcpy(record + 4, &crc, 4);
+
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    if (!file && !openNextUnlocked()) return 0;
+    if (fwrite(record, 1, 8 + length, file) != 8 + length || fflush(file)) {
+        std::cout << "Unable to append to journal" << std::endl;
+        failed = true;
+        close();
+        return 0;
+    }
+#if defined(__APPLE__) || defined(__linux__)
+    if (sync) fsync(fileno(file));
+#endif
+    file_size += 8 + length;
+    return recordNumber(sequence, ++file_records);
+}
+
+uint64_t EditJournal::beginCheckpoint()
+{
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    if (file) {
+        fclose(file);
+        file = 0;
+        file_size = 0;
+    } else if (!sequence) {
+        std::vector<uint64_t> seqs;
+        listFiles(seqs);
+        if (!seqs.empty()) sequence = seqs.back();
+    }
+    // Try again if the last file couldn't be written
+    failed = false;
+    uint64_t seq = sequence;
+    if (enabled) openNextUnlocked();
+    return seq;
+}
+
+void EditJournal::finishCheckpoint(uint64_t seq)
+{
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    std::vector<uint64_t> seqs;
+    listFiles(seqs);
+    std::error_code ec;
+    // The newest file stays even if it's covered, for its number, in case
+    // beginCheckpoint couldn't start another. Its edits are all in the
+    // saved chunks, so they won't be applied again.
+    for (uint64_t s : seqs) {
+        if (s <= seq && s != seqs.back()) std::filesystem::remove(fileName(s), ec);
+    }
+}
+
+bool EditJournal::wantsCheckpoint()
+{
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    return file_size >= checkpoint_bytes;
+}
+
+void EditJournal::close()
+{
+    if (file) {
+        fclose(file);
+        file = 0;
+        file_size = 0;
+    }
+}
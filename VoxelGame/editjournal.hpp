@@ -0,0 +1,90 @@
+#ifndef INCLUDED_EDIT_JOURNAL_HPP
+#define INCLUDED_EDIT_JOURNAL_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "position.hpp"
+
+/*
+Block edits are appended to a journal as they're made, so a chunk doesn't
+have to be rewritten for every block placed or broken to keep it. Chunks
+whose only changes are in the journal are saved much later (see
+World::nextSaveChunk), which turns many small edits into one write.
+
+The journal is a series of files, journal(1), journal(2), ... in the chunk
+storage directory. Each record has its length and a CRC, so a record cut
+off by a crash is found and ignored along with anything after it.
+
+Records are numbered, increasing across files and across runs, and each
+chunk saves the number of the newest record it includes (see
+Chunk::journal_record). A chunk may be saved any time after its edits were
+journaled, with changes that were never journaled on top, so an edit is
+only applied again to a chunk whose saved copy is older than it.
+
+A checkpoint starts a new file, saves every modified chunk, then deletes
+the older files, since everything in them is now in the regions. The new
+file is created right away, even if it stays empty, so the numbering
+carries on from it next time. On startup whatever files are left are read
+back and their edits applied to the chunks again (see
+World::recoverJournal).
+*/
+class EditJournal {
+public:
+    static EditJournal instance;
+    static constexpr uint32_t magic = 0x4a454756;   // "VGEJ"
+    static constexpr uint32_t version = 1;
+
+    struct Edit {
+        BlockPos pos;
+        std::string name;
+        uint8_t rotation;
+        uint64_t record;
+    };
+
+private:
+    std::mutex journal_mutex;
+    FILE *file;
+    uint64_t sequence;      // Of the file being appended to, 0 before opening
+    size_t file_size;
+    uint32_t file_records;
+    bool failed;
+
+    static std::string fileName(uint64_t seq);
+    // The file's sequence number, then the record's place in it from 1
+    static uint64_t recordNumber(uint64_t seq, uint32_t index) { return seq << 32 | index; }
+    static void listFiles(std::vector<uint64_t>& seqs);
+    static bool readFile(uint64_t seq, std::vector<Edit>& edits);
+    bool openNextUnlocked();
+
+public:
+    // Off for tools that write chunks themselves
+    bool enabled;
+    // fsync after every record, for edits that survive losing power
+    bool sync;
+    // Checkpoint once the current file is this big
+    size_t checkpoint_bytes;
+
+    EditJournal();
+    ~EditJournal();
+
+    // Edits left by the last run, oldest first, as they were made. The files
+    // stay until a checkpoint covers them.
+    void recover(std::vector<Edit>& edits);
+
+    // Append one block edit. Returns its record number, or 0 if it isn't in
+    // the journal, in which case the chunk has to be saved as usual.
+    uint64_t recordBlock(const BlockPos& pos, const std::string& name, int rotation);
+
+    // Start a new file. Once every chunk modified before now is saved, pass
+    // the result to finishCheckpoint to delete the files before it.
+    uint64_t beginCheckpoint();
+    void finishCheckpoint(uint64_t seq);
+    bool wantsCheckpoint();
+
+    void close();
+};
+
+#endif
@@ -296,10 +296,10 @@ void Entity::computeUpdates(const BlockPos& center, const glm::mat4& projection,
 void Entity::computeRender(RenderData *render_data, const BlockPos& center, const glm::dvec3& pos)
 {    
     render_data->clear();    
-    mesh->getTriangleVertices(facing::ALL_FACES, render_data->vertices, pos, center);
-    mesh->getTriangleTexCoords(facing::ALL_FACES, render_data->texcoords);
-    mesh->getTriangleNormals(facing::ALL_FACES, render_data->normals);
-    render_data->total_vertices += mesh->numTriangleVertices(facing::ALL_FACES);
+    mesh->getQuadVertices(facing::ALL_FACES, render_data->vertices, pos, center);
+    mesh->getQuadTexCoords(facing::ALL_FACES, render_data->texcoords);
+    mesh->getQuadNormals(facing::ALL_FACES, render_data->normals);
+    render_data->total_vertices += mesh->numQuadVertices(facing::ALL_FACES);
 }
 
 bool Entity::insideFrustum(const glm::mat4& view, const BlockPos& center)
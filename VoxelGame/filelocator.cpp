@@ -8,7 +8,7 @@
 //#include <fileapi.h>
 #include <Shlobj.h>
 #endif
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
 #include <sys/stat.h>
 #endif
 
@@ -24,7 +24,7 @@ BOOL FileExists(LPCSTR szPath)
 }
 #endif
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
 bool FileExists(const char* fname)
 {
     struct stat buffer;
@@ -63,10 +63,11 @@ std::string FileLocator::shader(const std::string& shader_name)
 
 std::string FileLocator::chunk(const std::string& chunk_name)
 {
+    std::string dir = storage_dir.size() ? storage_dir : base_config_dir + "/storage";
     if (chunk_name.size() == 0) {
-        return base_config_dir + "/storage";        
+        return dir;
     } else {
-        return base_config_dir + "/storage/" + chunk_name;
+        return dir + "/" + chunk_name;
     }
 }
 
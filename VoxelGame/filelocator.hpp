@@ -9,12 +9,19 @@ public:
     
 private:
     std::string base_config_dir;
+    std::string storage_dir;    // Defaults to <config>/storage if empty
     
 public:
     void setConfigDir(const std::string& dir) {
         base_config_dir = dir;
     }
     
+    // Keep chunks somewhere other than the config dir, e.g. a scratch
+    // directory for benchmarks
+    void setStorageDir(const std::string& dir) {
+        storage_dir = dir;
+    }
+    
     //FileLocator(const std::string& dir) {
     //    setConfigDir(dir);
     //}
@@ -0,0 +1,84 @@
+#include "framestats.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+FrameStats FrameStats::instance;
+
+static const char *counter_name[] = {
+    "trans_sort_ms",
+    "trans_resorts",
+    "trans_renderers",
+    "cull_ms",
+    "chunks_loaded",
+    "chunks_in_frustum",
+    "chunks_visible",
+    "chunk_draw_calls",
+    "arena_pages",
+    "arena_used_mb",
+    "arena_capacity_mb",
+    "arena_free_ranges",
+    "shader_binds",
+    "texture_binds",
+    "uniform_updates",
+    "binds_skipped",
+    "mesh_cache_hit_pct",
+    "mesh_cache_mb",
+};
+
+// Counters holding seconds are reported in milliseconds
+static const double counter_scale[] = {
+    1000.0,
+    1.0,
+    1.0,
+    1000.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+    1.0,
+};
+
+FrameStats::FrameStats()
+{
+    memset(frame, 0, sizeof(frame));
+    memset(total, 0, sizeof(total));
+    num_frames = 0;
+    last_report = 0;
+    report_interval = 5;
+    enabled = getenv("VOXELGAME_FRAME_STATS") != 0;
+}
+
+void FrameStats::endFrame(double now)
+{
+    for (int i=0; i<NUM_COUNTERS; i++) {
+        total[i] += frame[i];
+        frame[i] = 0;
+    }
+    num_frames++;
+
+    if (last_report == 0) last_report = now;
+    if (now - last_report < report_interval) return;
+
+    if (enabled) {
+        printf("Frame stats (avg of %d frames):", num_frames);
+        for (int i=0; i<NUM_COUNTERS; i++) {
+            printf(" %s=%.3f", counter_name[i], total[i] * counter_scale[i] / num_frames);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    memset(total, 0, sizeof(total));
+    num_frames = 0;
+    last_report = now;
+}
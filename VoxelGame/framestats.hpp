@@ -0,0 +1,58 @@
+#ifndef INCLUDED_FRAME_STATS_HPP
+#define INCLUDED_FRAME_STATS_HPP
+
+/*
+Per-frame rendering telemetry. Counters are accumulated by the graphics
+thread while drawing a frame and summarized to stdout every few seconds.
+Only touch these from the graphics thread.
+*/
+
+class FrameStats {
+public:
+    static FrameStats instance;
+
+    enum Counter {
+        TRANS_SORT_TIME,    // Seconds spent ordering translucent renderers
+        TRANS_RESORTS,      // Frames where the translucent order was recomputed
+        TRANS_RENDERERS,    // Translucent renderers drawn
+        CULL_TIME,          // Seconds spent culling chunks for drawing
+        CHUNKS_LOADED,      // Chunks considered for drawing
+        CHUNKS_IN_FRUSTUM,  // Chunks that passed frustum culling
+        CHUNKS_VISIBLE,     // Chunks that also passed occlusion culling
+        CHUNK_DRAW_CALLS,   // Multi-draws issued for opaque chunk geometry
+        ARENA_PAGES,        // GeometryArena buffers
+        ARENA_USED_MB,      // Vertex data held in the arena
+        ARENA_CAPACITY_MB,  // Size of all arena buffers
+        ARENA_FREE_RANGES,  // Free list entries, a measure of fragmentation
+        SHADER_BINDS,       // glUseProgram calls
+        TEXTURE_BINDS,      // glBindTexture calls
+        UNIFORM_UPDATES,    // Matrix uniforms set
+        BINDS_SKIPPED,      // Shader and texture binds that were already in place
+        MESH_CACHE_HIT_PERCENT, // Chunk meshes found in MeshCache, since startup
+        MESH_CACHE_MB,      // Render data held by MeshCache
+        NUM_COUNTERS
+    };
+
+private:
+    double frame[NUM_COUNTERS];
+    double total[NUM_COUNTERS];
+    int num_frames;
+    double last_report;
+
+public:
+    double report_interval;
+    // Print the summary. Off unless VOXELGAME_FRAME_STATS is set.
+    bool enabled;
+
+    FrameStats();
+
+    void add(Counter c, double v) { frame[c] += v; }
+    void set(Counter c, double v) { frame[c] = v; }
+    double get(Counter c) { return frame[c]; }
+
+    // Fold this frame's counters into the running totals and print a
+    // summary if report_interval has elapsed since the last one.
+    void endFrame(double now);
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "frustum.hpp"
+#include "chunk.hpp"
+#include <glm/gtc/matrix_access.hpp>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+void Frustum::extract(const glm::mat4& transform)
+{
+    const glm::vec4 row1(glm::row(transform, 0));
+    const glm::vec4 row2(glm::row(transform, 1));
+    const glm::vec4 row3(glm::row(transform, 2));
+    const glm::vec4 row4(glm::row(transform, 3));
+
+    // Same order as WorldView::outsideFrustum
+    planes[0] = row4 + row1;
+    planes[1] = row4 - row1;
+    planes[2] = row4 + row2;
+    planes[3] = row4 - row2;
+    planes[4] = row4 + row3;
+    planes[5] = row4 - row3;
+}
+
+// A box is outside a plane only if its corner furthest along the plane
+// normal (the "p-vertex") is outside. This culls exactly the boxes whose 8
+// corners are all outside one plane, which is what the old per-corner test
+// did.
+bool Frustum::testBox(const glm::vec3& lo, const glm::vec3& hi) const
+{
+    for (int i=0; i<6; i++) {
+        const glm::vec4& p(planes[i]);
+        float x = p.x >= 0 ? hi.x : lo.x;
+        float y = p.y >= 0 ? hi.y : lo.y;
+        float z = p.z >= 0 ? hi.z : lo.z;
+        if (p.x * x + p.y * y + p.z * z + p.w < 0) return false;
+    }
+    return true;
+}
+
+int Frustum::testBoxes4(const float *minx, const float *miny, const float *minz,
+                        const float *maxx, const float *maxy, const float *maxz) const
+{
+#ifdef FRUSTUM_SSE
+    __m128 x0 = _mm_loadu_ps(minx), x1 = _mm_loadu_ps(maxx);
+    __m128 y0 = _mm_loadu_ps(miny), y1 = _mm_loadu_ps(maxy);
+    __m128 z0 = _mm_loadu_ps(minz), z1 = _mm_loadu_ps(maxz);
+    __m128 zero = _mm_setzero_ps();
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+
+    for (int i=0; i<6; i++) {
+        const glm::vec4& p(planes[i]);
+        // The p-vertex choice depends only on the plane, so it's the same
+        // for all four boxes
+        __m128 x = p.x >= 0 ? x1 : x0;
+        __m128 y = p.y >= 0 ? y1 : y0;
+        __m128 z = p.z >= 0 ? z1 : z0;
+        __m128 d = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_mul_ps(y, _mm_set1_ps(p.y))),
+            _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.z)), _mm_set1_ps(p.w)));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(d, zero));
+    }
+
+    return _mm_movemask_ps(inside);
+#else
+    int mask = 0;
+    for (int j=0; j<4; j++) {
+        if (testBox(glm::vec3(minx[j], miny[j], minz[j]), glm::vec3(maxx[j], maxy[j], maxz[j]))) mask |= 1 << j;
+    }
+    return mask;
+#endif
+}
+
+void ChunkCuller::resizeBatch(size_t n)
+{
+    // Round up so the last group of four can be loaded whole
+    n = (n + 3) & ~size_t(3);
+    if (minx.size() >= n) return;
+    minx.resize(n);
+    miny.resize(n);
+    minz.resize(n);
+    maxx.resize(n);
+    maxy.resize(n);
+    maxz.resize(n);
+}
+
+void ChunkCuller::cull(const Frustum& frustum, const BlockPos& center, const std::vector<Chunk *>& chunks, std::vector<Chunk *>& visible)
+{
+    visible.clear();
+    columns_tested = 0;
+    chunks_tested = 0;
+    if (chunks.empty()) return;
+
+    // Group chunks into columns. listAllChunks comes out of a hash map in
+    // roughly the same order every frame, so this is usually cheap.
+    sorted.assign(chunks.begin(), chunks.end());
+    std::sort(sorted.begin(), sorted.end(), [](Chunk *a, Chunk *b) -> bool {
+        const ChunkPos& pa(a->getChunkPos());
+        const ChunkPos& pb(b->getChunkPos());
+        if (pa.X != pb.X) return pa.X < pb.X;
+        return pa.Z < pb.Z;
+    });
+
+    columns.clear();
+    for (size_t i=0; i<sorted.size(); i++) {
+        const ChunkPos& cp(sorted[i]->getChunkPos());
+        if (columns.empty() || columns.back().X != cp.X || columns.back().Z != cp.Z) {
+            columns.push_back(Column{cp.X, cp.Z, cp.Y, cp.Y, i, 0});
+        }
+        Column& col(columns.back());
+        col.count++;
+        if (cp.Y < col.minY) col.minY = cp.Y;
+        if (cp.Y > col.maxY) col.maxY = cp.Y;
+    }
+
+    // Column boxes, relative to center. Padding lanes are left with
+    // whatever they held; their result bits are ignored.
+    size_t nc = columns.size();
+    resizeBatch(nc);
+    for (size_t i=0; i<nc; i++) {
+        const Column& col(columns[i]);
+        minx[i] = col.X * 16 - center.X;
+        miny[i] = col.minY * 16 - center.Y;
+        minz[i] = col.Z * 16 - center.Z;
+        maxx[i] = minx[i] + 16;
+        maxy[i] = (col.maxY + 1) * 16 - center.Y;
+        maxz[i] = minz[i] + 16;
+    }
+
+    // Chunks of surviving columns are packed to the front of sorted
+    size_t num_candidates = 0;
+    for (size_t i=0; i<nc; i+=4) {
+        int mask = frustum.testBoxes4(&minx[i], &miny[i], &minz[i], &maxx[i], &maxy[i], &maxz[i]);
+        size_t n = std::min(nc - i, size_t(4));
+        for (size_t j=0; j<n; j++) {
+            if (!(mask & (1 << j))) continue;
+            const Column& col(columns[i+j]);
+            for (size_t k=0; k<col.count; k++) {
+                sorted[num_candidates++] = sorted[col.first + k];
+            }
+        }
+    }
+    columns_tested = (int)nc;
+
+    resizeBatch(num_candidates);
+    for (size_t i=0; i<num_candidates; i++) {
+        BlockPos corner = BlockPos::getBlockPos(sorted[i]->getChunkPos());
+        minx[i] = corner.X - center.X;
+        miny[i] = corner.Y - center.Y;
+        minz[i] = corner.Z - center.Z;
+        maxx[i] = minx[i] + 16;
+        maxy[i] = miny[i] + 16;
+        maxz[i] = minz[i] + 16;
+    }
+
+    for (size_t i=0; i<num_candidates; i+=4) {
+        int mask = frustum.testBoxes4(&minx[i], &miny[i], &minz[i], &maxx[i], &maxy[i], &maxz[i]);
+        size_t n = std::min(num_candidates - i, size_t(4));
+        for (size_t j=0; j<n; j++) {
+            if (mask & (1 << j)) visible.push_back(sorted[i+j]);
+        }
+    }
+    chunks_tested = (int)num_candidates;
+}
@@ -0,0 +1,61 @@
+#ifndef INCLUDED_FRUSTUM_HPP
+#define INCLUDED_FRUSTUM_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "position.hpp"
+
+class Chunk;
+
+// http://web.archive.org/web/20120531231005/http://crazyjoke.free.fr/doc/3D/plane%20extraction.pdf
+// View frustum as six planes extracted from projection * view. A point p is
+// inside plane i when dot(planes[i], vec4(p, 1)) >= 0. Extract once per frame
+// and test boxes against it; boxes are in the same center-relative space as
+// the view matrix.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    Frustum() {}
+    Frustum(const glm::mat4& transform) { extract(transform); }
+
+    void extract(const glm::mat4& transform);
+
+    // True if the box is at least partly inside
+    bool testBox(const glm::vec3& lo, const glm::vec3& hi) const;
+
+    // Test four boxes given as structure-of-arrays. Returns a mask where bit i
+    // is set if box i is at least partly inside.
+    int testBoxes4(const float *minx, const float *miny, const float *minz,
+                   const float *maxx, const float *maxy, const float *maxz) const;
+};
+
+/*
+Culls the loaded chunks against a frustum. Chunks are grouped into vertical
+columns; each column's bounding box is tested first and chunks are only
+tested individually in columns that survive. Both levels are tested four
+boxes at a time. Buffers are kept between calls so steady-state culling does
+not allocate.
+*/
+class ChunkCuller {
+private:
+    struct Column {
+        int32_t X, Z;
+        int32_t minY, maxY;
+        size_t first, count;
+    };
+
+    std::vector<Chunk *> sorted;
+    std::vector<Column> columns;
+    std::vector<float> minx, miny, minz, maxx, maxy, maxz;
+
+    void resizeBatch(size_t n);
+
+public:
+    int columns_tested, chunks_tested;
+
+    ChunkCuller() : columns_tested(0), chunks_tested(0) {}
+
+    void cull(const Frustum& frustum, const BlockPos& center, const std::vector<Chunk *>& chunks, std::vector<Chunk *>& visible);
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "gl_includes.hpp"
+#include "geometryarena.hpp"
+#include "render.hpp"
+#include "cameramodel.hpp"
+#include <algorithm>
+
+GeometryArena GeometryArena::instance;
+
+int GeometryArena::addPage(uint32_t min_vertices)
+{
+    Page p;
+    p.capacity = page_vertices;
+    while (p.capacity < min_vertices) p.capacity *= 2;
+
+    glGenVertexArrays(1, &p.VAO);
+    glGenBuffers(1, &p.VBO);
+    glBindVertexArray(p.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, p.VBO);
+    glBufferData(GL_ARRAY_BUFFER, (size_t)p.capacity * floats_per_vertex * sizeof(float), 0, GL_STATIC_DRAW);
+
+    // Same attribute numbers as Renderer's separate buffers
+    const int stride = floats_per_vertex * sizeof(float);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+
+    pages.push_back(p);
+    addFree(pages.back(), 0, p.capacity);
+    new_pages++;
+    return (int)pages.size() - 1;
+}
+
+void GeometryArena::addFree(Page& p, uint32_t first, uint32_t count)
+{
+    p.free_by_first[first] = count;
+    p.free_by_count.insert(std::make_pair(count, first));
+}
+
+void GeometryArena::removeFree(Page& p, std::map<uint32_t, uint32_t>::iterator i)
+{
+    auto range = p.free_by_count.equal_range(i->second);
+    for (auto j=range.first; j!=range.second; ++j) {
+        if (j->second == i->first) {
+            p.free_by_count.erase(j);
+            break;
+        }
+    }
+    p.free_by_first.erase(i);
+}
+
+bool GeometryArena::allocateIn(int page, uint32_t count, Range& r)
+{
+    Page& p(pages[page]);
+    auto best = p.free_by_count.lower_bound(count);
+    if (best == p.free_by_count.end()) return false;
+
+    uint32_t first = best->second;
+    uint32_t free_count = best->first;
+    removeFree(p, p.free_by_first.find(first));
+    if (free_count > count) addFree(p, first + count, free_count - count);
+
+    r.page = page;
+    r.first = first;
+    r.count = count;
+    return true;
+}
+
+GeometryArena::Range GeometryArena::upload(const RenderData& data)
+{
+    Range r;
+    uint32_t count = data.total_vertices;
+    if (!count) return r;
+
+    bool found = false;
+    for (size_t i=0; i<pages.size() && !found; i++) {
+        found = allocateIn((int)i, count, r);
+    }
+    if (!found) allocateIn(addPage(count), count, r);
+
+    // Interleave the three streams
+    staging.resize((size_t)count * floats_per_vertex);
+    float *out = staging.data();
+    for (uint32_t v=0; v<count; v++) {
+        const float *pos = &data.vertices[v*3];
+        const float *norm = &data.normals[v*3];
+        const float *tc = &data.texcoords[v*3];
+        out[0] = pos[0]; out[1] = pos[1]; out[2] = pos[2];
+        out[3] = norm[0]; out[4] = norm[1]; out[5] = norm[2];
+        out[6] = tc[0]; out[7] = tc[1]; out[8] = tc[2];
+        out += floats_per_vertex;
+    }
+
+    Page& p(pages[r.page]);
+    size_t bytes = staging.size() * sizeof(float);
+    glBindVertexArray(p.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, p.VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, (size_t)r.first * floats_per_vertex * sizeof(float), bytes, staging.data());
+    QuadIndexBuffer::instance.bind(count / 4);
+    glBindVertexArray(0);
+
+    allocations++;
+    uploaded_bytes += bytes;
+    used_vertices += count;
+    return r;
+}
+
+void GeometryArena::free(Range& r)
+{
+    if (!r.valid()) return;
+    Page& p(pages[r.page]);
+    uint32_t first = r.first, count = r.count;
+
+    // Merge with the free ranges on either side
+    auto next = p.free_by_first.lower_bound(first);
+    if (next != p.free_by_first.end() && next->first == first + count) {
+        count += next->second;
+        removeFree(p, next);
+    }
+    auto after = p.free_by_first.lower_bound(first);
+    if (after != p.free_by_first.begin()) {
+        auto prev = std::prev(after);
+        if (prev->first + prev->second == first) {
+            first = prev->first;
+            count += prev->second;
+            removeFree(p, prev);
+        }
+    }
+    addFree(p, first, count);
+
+    frees++;
+    used_vertices -= r.count;
+    r = Range();
+}
+
+void GeometryArena::bindPage(int page)
+{
+    glBindVertexArray(pages[page].VAO);
+}
+
+size_t GeometryArena::capacityBytes()
+{
+    size_t total = 0;
+    for (const Page& p : pages) total += (size_t)p.capacity * floats_per_vertex * sizeof(float);
+    return total;
+}
+
+size_t GeometryArena::numFreeRanges()
+{
+    size_t total = 0;
+    for (const Page& p : pages) total += p.free_by_first.size();
+    return total;
+}
+
+size_t GeometryArena::freeVertices()
+{
+    size_t total = 0;
+    for (const Page& p : pages) {
+        for (const auto& f : p.free_by_first) total += f.second;
+    }
+    return total;
+}
+
+void DrawList::add(Shader *shader, TextureArray *tex, const BlockPos& center, int page, uint32_t first, uint32_t count)
+{
+    // Consecutive chunks are usually in the same group
+    size_t g = num_groups;
+    while (g > 0) {
+        const Group& group(groups[g-1]);
+        if (group.shader == shader && group.tex == tex && group.center == center && group.page == page) break;
+        g--;
+    }
+    if (g == 0) {
+        if (num_groups == groups.size()) groups.push_back(Group());
+        Group& group(groups[num_groups++]);
+        group.shader = shader;
+        group.tex = tex;
+        group.center = center;
+        group.page = page;
+        group.counts.clear();
+        group.base_vertex.clear();
+        g = num_groups;
+    }
+
+    Group& group(groups[g-1]);
+    group.counts.push_back(QuadIndexBuffer::numIndices(count));
+    group.base_vertex.push_back(first);
+}
+
+int DrawList::submit(CameraModel *camera)
+{
+    order.clear();
+    for (size_t g=0; g<num_groups; g++) order.push_back(&groups[g]);
+    std::sort(order.begin(), order.end(), [](const Group *a, const Group *b) -> bool {
+        if (a->shader != b->shader) return a->shader < b->shader;
+        if (a->tex != b->tex) return a->tex < b->tex;
+        if (a->center.X != b->center.X) return a->center.X < b->center.X;
+        if (a->center.Y != b->center.Y) return a->center.Y < b->center.Y;
+        if (a->center.Z != b->center.Z) return a->center.Z < b->center.Z;
+        return a->page < b->page;
+    });
+
+    Shader *last_shader = 0;
+    BlockPos last_center(0, 0, 0);
+    int last_page = -1;
+    for (Group *group : order) {
+        // Shader and texture skip their own repeat binds
+        group->tex->use(0);
+        if (group->shader != last_shader || !(group->center == last_center)) {
+            glm::mat4 view = camera->getViewMatrix(group->center.X, group->center.Y, group->center.Z);
+            group->shader->setMat4(group->shader->uniformLocation("view"), view);
+            last_shader = group->shader;
+            last_center = group->center;
+        }
+        if (group->page != last_page) {
+            GeometryArena::instance.bindPage(group->page);
+            last_page = group->page;
+        }
+
+        // Every draw starts at index 0; base_vertex picks the range
+        if (offsets.size() < group->counts.size()) offsets.resize(group->counts.size(), 0);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, group->counts.data(), GL_UNSIGNED_INT,
+            offsets.data(), (GLsizei)group->counts.size(), group->base_vertex.data());
+    }
+    glBindVertexArray(0);
+    return (int)num_groups;
+}
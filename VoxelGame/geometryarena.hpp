@@ -0,0 +1,109 @@
+#ifndef INCLUDED_GEOMETRY_ARENA_HPP
+#define INCLUDED_GEOMETRY_ARENA_HPP
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "position.hpp"
+
+struct RenderData;
+class Shader;
+class TextureArray;
+class CameraModel;
+
+/*
+Block geometry lives in a few large vertex buffers instead of three small
+VBOs per renderer, so remeshing doesn't keep allocating and freeing driver
+memory. Each page is one interleaved buffer (position, normal, u/v/layer)
+with its own VAO, and a best-fit free list over vertex ranges that coalesces
+neighbors when a range is freed. A new page is added when nothing fits.
+Drawing uses QuadIndexBuffer with a base vertex, so only GL 3.2 core
+features are needed. Graphics thread only.
+*/
+class GeometryArena {
+public:
+    static GeometryArena instance;
+
+    static constexpr int floats_per_vertex = 9;
+
+    struct Range {
+        int page;
+        uint32_t first;     // In vertices
+        uint32_t count;
+        Range() : page(-1), first(0), count(0) {}
+        bool valid() const { return page >= 0; }
+    };
+
+private:
+    struct Page {
+        unsigned int VAO, VBO;
+        uint32_t capacity;
+        std::map<uint32_t, uint32_t> free_by_first;         // first -> count
+        std::multimap<uint32_t, uint32_t> free_by_count;    // count -> first
+    };
+    std::vector<Page> pages;
+    std::vector<float> staging;
+
+    int addPage(uint32_t min_vertices);
+    bool allocateIn(int page, uint32_t count, Range& r);
+    void addFree(Page& p, uint32_t first, uint32_t count);
+    void removeFree(Page& p, std::map<uint32_t, uint32_t>::iterator i);
+
+public:
+    // Vertices per page. Bigger meshes get a page of their own size.
+    uint32_t page_vertices;
+
+    // Running totals
+    size_t allocations, frees, new_pages, uploaded_bytes;
+    size_t used_vertices;
+
+    GeometryArena() : page_vertices(1 << 21), allocations(0), frees(0), new_pages(0),
+        uploaded_bytes(0), used_vertices(0) {}
+
+    // Copy data into a new range. Data with no vertices gets no range.
+    Range upload(const RenderData& data);
+    void free(Range& r);
+    void bindPage(int page);
+
+    size_t numPages() { return pages.size(); }
+    uint32_t pageCapacity(int page) { return pages[page].capacity; }
+    size_t capacityBytes();
+    size_t usedBytes() { return used_vertices * floats_per_vertex * sizeof(float); }
+    size_t numFreeRanges();
+    // Vertices on the free lists of all pages
+    size_t freeVertices();
+};
+
+/*
+Arena draws collected over a frame. Draws that share a shader, texture
+array, mesh center and page go out as one glMultiDrawElementsBaseVertex.
+Groups are submitted sorted by that key, most expensive state first, so each
+program, texture and view matrix is set once per run of groups that use it.
+Storage is kept between frames.
+*/
+class DrawList {
+private:
+    struct Group {
+        Shader *shader;
+        TextureArray *tex;
+        BlockPos center;
+        int page;
+        std::vector<int> counts;
+        std::vector<int> base_vertex;
+        Group() : shader(0), tex(0), center(0, 0, 0), page(0) {}
+    };
+    std::vector<Group> groups;
+    size_t num_groups;
+    std::vector<Group *> order;
+    std::vector<const void *> offsets;
+
+public:
+    DrawList() : num_groups(0) {}
+
+    void clear() { num_groups = 0; }
+    void add(Shader *shader, TextureArray *tex, const BlockPos& center, int page, uint32_t first, uint32_t count);
+    // Returns the number of GL draw calls made
+    int submit(CameraModel *camera);
+};
+
+#endif
@@ -2,6 +2,10 @@
 #define GLFW_INCLUDE_GLCOREARB
 #define GL_SILENCE_DEPRECATION
 #endif
+#ifdef __linux__
+#define GL_GLEXT_PROTOTYPES
+#define GLFW_INCLUDE_GLEXT
+#endif
 #if defined _WIN32 || defined _WIN64
 #include "glad/glad.h"
 #endif
@@ -10,6 +10,7 @@
 #include "worldview.hpp"
 #include "compat.hpp"
 #include "uielements.hpp"
+#include "framestats.hpp"
 // #include "longconcurrentmap.hpp"
 #include <stdlib.h>
 #include <glm/gtx/string_cast.hpp>
@@ -131,7 +132,7 @@ void make_entity()
 
 void rotation_test();
 
-#if defined(_DEBUG) || defined(__APPLE__)
+#if defined(_DEBUG) || defined(__APPLE__) || defined(__linux__)
 int main()
 #else
 int WinMain()
@@ -290,6 +291,7 @@ int WinMain()
 
         // window.next_frame();
         window.swap_buffers();
+        FrameStats::instance.endFrame(now);
     }
     
     World::instance.saveAll();
@@ -0,0 +1,61 @@
+#include "memoryarena.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+MemoryArena::MemoryArena(size_t block_size) : blocks(0), pos(0), end(0), block_size(block_size) {}
+
+MemoryArena::~MemoryArena()
+{
+    freeBlocks();
+}
+
+void MemoryArena::addBlock(size_t min_size)
+{
+    size_t size = block_size;
+    if (size < min_size) size = min_size;
+    Block *b = (Block *)malloc(sizeof(Block) + size);
+    if (!b) throw std::bad_alloc();
+    b->next = blocks;
+    b->size = size;
+    blocks = b;
+    pos = (char *)(b + 1);
+    end = pos + size;
+}
+
+void MemoryArena::freeBlocks()
+{
+    while (blocks) {
+        Block *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+    pos = end = 0;
+}
+
+char *MemoryArena::copy(const void *p, size_t len)
+{
+    char *c = (char *)alloc(len, 1);
+    if (len) memcpy(c, p, len);
+    return c;
+}
+
+void MemoryArena::reset()
+{
+    if (!blocks) return;
+    if (blocks->next) {
+        // Next time it all fits in one
+        size_t total = capacity();
+        freeBlocks();
+        if (block_size < total) block_size = total;
+        addBlock(block_size);
+    } else {
+        pos = (char *)(blocks + 1);
+    }
+}
+
+size_t MemoryArena::capacity() const
+{
+    size_t total = 0;
+    for (Block *b = blocks; b; b = b->next) total += b->size;
+    return total;
+}
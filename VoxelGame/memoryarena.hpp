@@ -0,0 +1,60 @@
+#ifndef INCLUDED_MEMORY_ARENA_HPP
+#define INCLUDED_MEMORY_ARENA_HPP
+
+#include <stddef.h>
+#include <string_view>
+#include <new>
+
+/*
+Bump allocator for short-lived things that all go at once. Allocating just
+moves a pointer through a block; nothing is freed on its own, and
+destructors aren't run, so only put trivially destructible things in it.
+reset() frees everything. When more than one block was needed since the
+last reset, they're replaced by a single block as big as all of them, so a
+reused arena soon stops calling malloc at all.
+
+Not thread safe. Give each thread its own.
+*/
+class MemoryArena {
+private:
+    struct Block {
+        Block *next;
+        size_t size;
+    };
+
+    Block *blocks;
+    char *pos, *end;
+    size_t block_size;
+
+    void addBlock(size_t min_size);
+    void freeBlocks();
+
+public:
+    MemoryArena(size_t block_size = 64 << 10);
+    ~MemoryArena();
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    void *alloc(size_t len, size_t align = alignof(max_align_t)) {
+        char *p = (char *)(((size_t)pos + align - 1) & ~(align - 1));
+        if (!pos || p + len > end) {
+            addBlock(len + align);
+            p = (char *)(((size_t)pos + align - 1) & ~(align - 1));
+        }
+        pos = p + len;
+        return p;
+    }
+
+    template<typename T>
+    T *make() { return new (alloc(sizeof(T), alignof(T))) T(); }
+
+    // Copy of the bytes, or of the string, that lasts until reset
+    char *copy(const void *p, size_t len);
+    std::string_view copyString(std::string_view s) { return std::string_view(copy(s.data(), s.size()), s.size()); }
+
+    void reset();
+    // Bytes in all blocks
+    size_t capacity() const;
+};
+
+#endif
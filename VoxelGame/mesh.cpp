@@ -3,58 +3,52 @@
 
 void Face::computeNormal()
 {
-    glm::vec3 a, b, c;
+    glm::vec3 x;
     if (num_vertices==3) {
-        a = vertices[0];
-        b = vertices[1];
-        c = vertices[2];
+        glm::vec3& a(vertices[0]);
+        glm::vec3& b(vertices[1]);
+        glm::vec3& c(vertices[2]);
+        glm::vec3 cb = c - b;
+        glm::vec3 ab = a - b;
+        x = glm::cross(cb, ab);
     } else {
-        if (vertices[0] == vertices[1] || vertices[1] == vertices[2]) {
-            a = vertices[0];
-            b = vertices[2];
-            c = vertices[3];
-        } else {
-            a = vertices[0];
-            b = vertices[1];
-            c = vertices[2];
-        }
+        // Cross of the diagonals. Same as the triangle normal for flat
+        // quads, handles a repeated corner, and averages the two halves of
+        // a bent one.
+        x = glm::cross(vertices[2] - vertices[0], vertices[3] - vertices[1]);
     }
-    // glm::vec3& a(vertices[0]);
-    // glm::vec3& b(vertices[1]);
-    // glm::vec3& c(vertices[2]);
-    glm::vec3 cb = c - b;
-    glm::vec3 ab = a - b;
-    glm::vec3 x = glm::cross(cb, ab);
     float mag = glm::length(x);
     x /= mag;
     normal = x;
 }
 
-static const unsigned int face_indices[] = {
-    0, 1, 2, 0, 2, 3
-};
+// Index of the face vertex to emit as quad corner i
+static inline int quadCorner(int i, int num_vertices)
+{
+    return i < num_vertices ? i : num_vertices - 1;
+}
 
-// void Face::getTriangleVertices(std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center)
-void Face::getTriangleVertices(std::vector<float>& vertices_out, float offsetX, float offsetY, float offsetZ)
+// void Face::getQuadVertices(std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center)
+void Face::getQuadVertices(std::vector<float>& vertices_out, float offsetX, float offsetY, float offsetZ)
 {
     // int offsetX = pos.X - center.X;
     // int offsetY = pos.Y - center.Y;
     // int offsetZ = pos.Z - center.Z;
     
-    int loops = numTriangleVertices();
+    int loops = numQuadVertices();
     for (int i=0; i<loops; i++) {
-        int v = face_indices[i];
+        int v = quadCorner(i, num_vertices);
         vertices_out.push_back(vertices[v].x + offsetX);
         vertices_out.push_back(vertices[v].y + offsetY);
         vertices_out.push_back(vertices[v].z + offsetZ);
     }
 }
 
-void Face::getTriangleVertices(std::vector<float>& vertices_out, const glm::mat4& rotation, float offsetX, float offsetY, float offsetZ)
+void Face::getQuadVertices(std::vector<float>& vertices_out, const glm::mat4& rotation, float offsetX, float offsetY, float offsetZ)
 {
-    int loops = numTriangleVertices();
+    int loops = numQuadVertices();
     for (int i=0; i<loops; i++) {
-        int v = face_indices[i];
+        int v = quadCorner(i, num_vertices);
         glm::vec3 rv = rotation * glm::vec4(vertices[v], 1.0f);
         vertices_out.push_back(rv.x + offsetX);
         vertices_out.push_back(rv.y + offsetY);
@@ -62,19 +56,30 @@ void Face::getTriangleVertices(std::vector<float>& vertices_out, const glm::mat4
     }
 }
 
-void Face::getTriangleTextcoords(std::vector<float>& texcoords_out)
+void Face::getQuadTexCoords(std::vector<float>& texcoords_out)
+{
+    int loops = numQuadVertices();
+    for (int i=0; i<loops; i++) {
+        int v = quadCorner(i, num_vertices);
+        texcoords_out.push_back(texcoords[v].x);
+        texcoords_out.push_back(texcoords[v].y);
+    }
+}
+
+void Face::getQuadTexCoords(std::vector<float>& texcoords_out, float layer)
 {
-    int loops = numTriangleVertices();
+    int loops = numQuadVertices();
     for (int i=0; i<loops; i++) {
-        int v = face_indices[i];
+        int v = quadCorner(i, num_vertices);
         texcoords_out.push_back(texcoords[v].x);
         texcoords_out.push_back(texcoords[v].y);
+        texcoords_out.push_back(layer);
     }
 }
 
-void Face::getTriangleNormals(std::vector<float>& normals_out)
+void Face::getQuadNormals(std::vector<float>& normals_out)
 {
-    int loops = numTriangleVertices();
+    int loops = numQuadVertices();
     for (int i=0; i<loops; i++) {
         normals_out.push_back(normal.x);
         normals_out.push_back(normal.y);
@@ -82,9 +87,9 @@ void Face::getTriangleNormals(std::vector<float>& normals_out)
     }
 }
 
-void Face::getTriangleNormals(std::vector<float>& normals_out, const glm::mat4& rotation)
+void Face::getQuadNormals(std::vector<float>& normals_out, const glm::mat4& rotation)
 {
-    int loops = numTriangleVertices();
+    int loops = numQuadVertices();
     glm::vec3 rn = rotation * glm::vec4(normal, 0.0f);
     for (int i=0; i<loops; i++) {
         normals_out.push_back(rn.x);
@@ -94,23 +99,23 @@ void Face::getTriangleNormals(std::vector<float>& normals_out, const glm::mat4&
 }
 
 
-int Mesh::numTriangleVertices(int show_faces)
+int Mesh::numQuadVertices(int show_faces)
 {
     int total = 0;
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        total += faces[face].numTriangleVertices();
+        total += faces[face].numQuadVertices();
     }
     return total;
 }
 
-void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const BlockPos& pos, const BlockPos& center)
+void Mesh::getQuadVertices(int show_faces, std::vector<float>& vertices_out, const BlockPos& pos, const BlockPos& center)
 {
     glm::dvec3 pos2(pos.X, pos.Y, pos.Z);
-    getTriangleVertices(show_faces, vertices_out, pos2, center);
+    getQuadVertices(show_faces, vertices_out, pos2, center);
 }
 
-void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center)
+void Mesh::getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center)
 {
     double offsetX = pos.x - center.X;
     double offsetY = pos.y - center.Y;
@@ -118,17 +123,17 @@ void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out,
     
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        faces[face].getTriangleVertices(vertices_out, (float)offsetX, (float)offsetY, (float)offsetZ);
+        faces[face].getQuadVertices(vertices_out, (float)offsetX, (float)offsetY, (float)offsetZ);
     }
 }
 
-void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const BlockPos& pos, const BlockPos& center)
+void Mesh::getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const BlockPos& pos, const BlockPos& center)
 {
     glm::dvec3 pos2(pos.X, pos.Y, pos.Z);
-    getTriangleVertices(show_faces, vertices_out, rotation, pos2, center);
+    getQuadVertices(show_faces, vertices_out, rotation, pos2, center);
 }
 
-void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const glm::dvec3& pos, const BlockPos& center)
+void Mesh::getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const glm::dvec3& pos, const BlockPos& center)
 {
     double offsetX = pos.x - center.X;
     double offsetY = pos.y - center.Y;
@@ -136,32 +141,40 @@ void Mesh::getTriangleVertices(int show_faces, std::vector<float>& vertices_out,
     
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        faces[face].getTriangleVertices(vertices_out, rotation, (float)offsetX, (float)offsetY, (float)offsetZ);
+        faces[face].getQuadVertices(vertices_out, rotation, (float)offsetX, (float)offsetY, (float)offsetZ);
     }
 }
 
 
-void Mesh::getTriangleTexCoords(int show_faces, std::vector<float>& texcoords_out)
+void Mesh::getQuadTexCoords(int show_faces, std::vector<float>& texcoords_out)
+{
+    for (int face=0; face<faces.size(); face++) {
+        if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
+        faces[face].getQuadTexCoords(texcoords_out);
+    }
+}
+
+void Mesh::getQuadTexCoords(int show_faces, std::vector<float>& texcoords_out, float layer)
 {
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        faces[face].getTriangleTextcoords(texcoords_out);
+        faces[face].getQuadTexCoords(texcoords_out, layer);
     }
 }
 
-void Mesh::getTriangleNormals(int show_faces, std::vector<float>& normals_out)
+void Mesh::getQuadNormals(int show_faces, std::vector<float>& normals_out)
 {
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        faces[face].getTriangleNormals(normals_out);
+        faces[face].getQuadNormals(normals_out);
     }
 }
 
-void Mesh::getTriangleNormals(int show_faces, std::vector<float>& normals_out, const glm::mat4& rotation)
+void Mesh::getQuadNormals(int show_faces, std::vector<float>& normals_out, const glm::mat4& rotation)
 {
     for (int face=0; face<faces.size(); face++) {
         if (face<facing::NUM_FACES && !facing::hasFace(show_faces, face)) continue;
-        faces[face].getTriangleNormals(normals_out, rotation);
+        faces[face].getQuadNormals(normals_out, rotation);
     }
 }
 
@@ -43,15 +43,18 @@ public:
     glm::vec3& getVertex(int n) { return vertices[n]; }
     glm::vec2& getTexCoord(int n) { return texcoords[n]; }
     
-    // Getting a face into a triangle list
-    void getTriangleVertices(std::vector<float>& vertices_out, float offsetX, float offsetY, float offsetZ);
-    void getTriangleVertices(std::vector<float>& vertices_out, const glm::mat4& rotation, float offsetX, float offsetY, float offsetZ);
-    void getTriangleTextcoords(std::vector<float>& texcoords_out);
-    void getTriangleNormals(std::vector<float>& normals_out);
-    void getTriangleNormals(std::vector<float>& normals_out, const glm::mat4& rotation);
-    int numTriangleVertices() {
-        if (!numVertices()) return 0;
-        return (numVertices()==3) ? 3 : 6;
+    // Getting a face into a quad list. Every face comes out as 4 vertices,
+    // drawn as triangles 0-1-2 and 0-2-3 (see QuadIndexBuffer). Triangles
+    // repeat their last vertex, which makes the second triangle degenerate.
+    void getQuadVertices(std::vector<float>& vertices_out, float offsetX, float offsetY, float offsetZ);
+    void getQuadVertices(std::vector<float>& vertices_out, const glm::mat4& rotation, float offsetX, float offsetY, float offsetZ);
+    void getQuadTexCoords(std::vector<float>& texcoords_out);
+    // For texture arrays: (u, v, layer)
+    void getQuadTexCoords(std::vector<float>& texcoords_out, float layer);
+    void getQuadNormals(std::vector<float>& normals_out);
+    void getQuadNormals(std::vector<float>& normals_out, const glm::mat4& rotation);
+    int numQuadVertices() {
+        return numVertices() ? 4 : 0;
         // XXX support bigger polygons later?
     }
 };
@@ -101,14 +104,15 @@ public:
     
     // Getting a mesh into a triangle list
     int getTextureIndex() { return texture_index; }
-    int numTriangleVertices(int show_faces);
-    void getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center);
-    void getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const BlockPos& pos, const BlockPos& center);
-    void getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const glm::dvec3& pos, const BlockPos& center);
-    void getTriangleVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const BlockPos& pos, const BlockPos& center);
-    void getTriangleTexCoords(int show_faces, std::vector<float>& texcoords_out);
-    void getTriangleNormals(int show_faces, std::vector<float>& normals_out);
-    void getTriangleNormals(int show_faces, std::vector<float>& normals_out, const glm::mat4& rotation);
+    int numQuadVertices(int show_faces);
+    void getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::dvec3& pos, const BlockPos& center);
+    void getQuadVertices(int show_faces, std::vector<float>& vertices_out, const BlockPos& pos, const BlockPos& center);
+    void getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const glm::dvec3& pos, const BlockPos& center);
+    void getQuadVertices(int show_faces, std::vector<float>& vertices_out, const glm::mat4& rotation, const BlockPos& pos, const BlockPos& center);
+    void getQuadTexCoords(int show_faces, std::vector<float>& texcoords_out);
+    void getQuadTexCoords(int show_faces, std::vector<float>& texcoords_out, float layer);
+    void getQuadNormals(int show_faces, std::vector<float>& normals_out);
+    void getQuadNormals(int show_faces, std::vector<float>& normals_out, const glm::mat4& rotation);
     bool isTranslucent() { return translucent; }
     
     // Create a new mesh
@@ -0,0 +1,168 @@
+#include "meshcache.hpp"
+#include "constants.hpp"
+#include <string.h>
+
+MeshCache MeshCache::instance;
+
+MeshCache::MeshCache() : used_bytes(0), enabled(true), max_bytes(32 << 20), max_seen(16384),
+    hits(0), misses(0), evictions(0) {}
+
+// Texture counts go first since they decide which array and layer each
+// mesh's texture lands in
+void MeshCache::Key::clear(size_t num_tex, size_t num_arrays)
+{
+    words.clear();
+    meshes.clear();
+    words.push_back(num_tex);
+    words.push_back(num_arrays);
+    run_mesh = 0;
+    run_rotation = 0;
+    run_length = 0;
+}
+
+// Each run is two words: the mesh, then rotation and length. Nothing else
+// about a block changes how it's culled or meshed.
+void MeshCache::Key::addRun(const MeshPtr& mesh, int rotation)
+{
+    if (run_length) {
+        words.push_back((uint64_t)(uintptr_t)run_mesh);
+        words.push_back((uint64_t)run_length << 8 | (uint64_t)run_rotation);
+    }
+    if (mesh && (meshes.empty() || meshes.back() != mesh)) meshes.push_back(mesh);
+    run_mesh = mesh.get();
+    run_rotation = rotation;
+    run_length = 1;
+}
+
+// FNV-1a over whole words
+void MeshCache::Key::finish()
+{
+    addRun(MeshPtr(), 0);
+    run_length = 0;
+    uint64_t h = 14695981039346656037ULL;
+    for (uint64_t w : words) {
+        h ^= w;
+        h *= 1099511628211ULL;
+    }
+    hash = h ^ (h >> 29);
+}
+
+std::list<MeshCache::Entry>::iterator MeshCache::find(const Key& key)
+{
+    auto range = index.equal_range(key.hash);
+    for (auto i=range.first; i!=range.second; ++i) {
+        if (i->second->words == key.words) return i->second;
+    }
+    return lru.end();
+}
+
+void MeshCache::evict(size_t limit)
+{
+    while (used_bytes > limit && !lru.empty()) {
+        auto last = std::prev(lru.end());
+        auto range = index.equal_range(last->hash);
+        for (auto i=range.first; i!=range.second; ++i) {
+            if (i->second == last) {
+                index.erase(i);
+                break;
+            }
+        }
+        used_bytes -= last->bytes;
+        lru.erase(last);
+        evictions++;
+    }
+}
+
+bool MeshCache::fetch(const Key& key, const BlockPos& offset, RenderData **out, size_t num_arrays,
+    uint8_t *show_faces, FaceConnectivity& connectivity)
+{
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    auto e = find(key);
+    if (e == lru.end() || e->data.size() != num_arrays) {
+        misses++;
+        return false;
+    }
+    lru.splice(lru.begin(), lru, e);
+    hits++;
+    memcpy(show_faces, e->show_faces.data(), e->show_faces.size());
+    connectivity = e->connectivity;
+
+    float dx = offset.X - e->offset.X, dy = offset.Y - e->offset.Y, dz = offset.Z - e->offset.Z;
+    for (size_t ai=0; ai<num_arrays; ai++) {
+        const RenderData& src(e->data[ai]);
+        RenderData *dst = out[ai];
+        dst->clear();
+        if (!src.total_vertices) {
+            dst->release();
+            continue;
+        }
+        dst->reserve(src.total_vertices);
+        dst->vertices.assign(src.vertices.begin(), src.vertices.end());
+        dst->normals.assign(src.normals.begin(), src.normals.end());
+        dst->texcoords.assign(src.texcoords.begin(), src.texcoords.end());
+        dst->total_vertices = src.total_vertices;
+        if (dx || dy || dz) {
+            std::vector<float>& v(dst->vertices);
+            for (size_t j=0; j<v.size(); j+=3) {
+                v[j+0] += dx;
+                v[j+1] += dy;
+                v[j+2] += dz;
+            }
+        }
+    }
+    return true;
+}
+
+void MeshCache::insert(const Key& key, const BlockPos& offset, RenderData **data, size_t num_arrays,
+    const uint8_t *show_faces, FaceConnectivity connectivity)
+{
+    size_t bytes = key.words.size() * sizeof(uint64_t) + sizes::chunk_storage_size;
+    for (size_t ai=0; ai<num_arrays; ai++) {
+        const RenderData *d = data[ai];
+        bytes += (d->vertices.size() + d->normals.size() + d->texcoords.size()) * sizeof(float);
+    }
+    if (bytes > max_bytes / 4) return;     // Not worth pushing everything else out
+
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    // Most chunks are one of a kind, and copying them in would only push
+    // out the ones that repeat
+    if (seen.insert(key.hash).second) {
+        if (seen.size() > max_seen) {
+            seen.clear();
+            seen.insert(key.hash);
+        }
+        return;
+    }
+    auto old = find(key);
+    if (old != lru.end()) return;
+
+    lru.push_front(Entry());
+    Entry& e(lru.front());
+    e.words = key.words;
+    e.meshes = key.meshes;
+    e.hash = key.hash;
+    e.offset = offset;
+    e.bytes = bytes;
+    e.show_faces.assign(show_faces, show_faces + sizes::chunk_storage_size);
+    e.connectivity = connectivity;
+    e.data.resize(num_arrays, RenderData(3));
+    for (size_t ai=0; ai<num_arrays; ai++) {
+        RenderData& d(e.data[ai]);
+        d.vertices = data[ai]->vertices;
+        d.normals = data[ai]->normals;
+        d.texcoords = data[ai]->texcoords;
+        d.total_vertices = data[ai]->total_vertices;
+    }
+    index.insert(std::make_pair(key.hash, lru.begin()));
+    used_bytes += bytes;
+    evict(max_bytes);
+}
+
+void MeshCache::clear()
+{
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    index.clear();
+    lru.clear();
+    seen.clear();
+    used_bytes = 0;
+}
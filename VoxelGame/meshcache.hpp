@@ -0,0 +1,108 @@
+#ifndef INCLUDED_MESH_CACHE_HPP
+#define INCLUDED_MESH_CACHE_HPP
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include "position.hpp"
+#include "mesh.hpp"
+#include "render.hpp"
+#include "occlusion.hpp"
+
+/*
+Meshing results for whole chunks, keyed by everything that goes into them:
+the mesh and rotation of every block in the chunk and of the blocks across
+each of its six borders. Generated terrain repeats itself a lot, so a chunk
+whose key is already here skips face culling and meshing. It takes the
+other chunk's visible faces and connectivity, and a copy of its opaque
+render data moved to its own position.
+
+Keys are compared in full, not only by hash. Entries hold on to the meshes
+they were made from, so a freed mesh's address can't turn up again in a
+different key. A key is only copied in the second time it misses, so
+one-of-a-kind chunks cost a hash lookup and nothing else. Least recently
+used entries are evicted past max_bytes.
+*/
+class MeshCache {
+public:
+    static MeshCache instance;
+
+    struct Key {
+        std::vector<uint64_t> words;
+        std::vector<MeshPtr> meshes;    // Kept alive by entries
+        uint64_t hash;
+
+        // Runs of the same block are stored once
+        Mesh *run_mesh;
+        int run_rotation, run_length;
+
+        void clear(size_t num_tex, size_t num_arrays);
+        // A null mesh is an empty block
+        void addBlock(const MeshPtr& mesh, int rotation) {
+            if (run_length && mesh.get() == run_mesh && rotation == run_rotation) {
+                run_length++;
+                return;
+            }
+            addRun(mesh, rotation);
+        }
+        void addRun(const MeshPtr& mesh, int rotation);
+        void finish();
+    };
+
+private:
+    struct Entry {
+        std::vector<uint64_t> words;
+        std::vector<MeshPtr> meshes;
+        uint64_t hash;
+        // Chunk corner minus mesh center the data was made with
+        BlockPos offset;
+        std::vector<RenderData> data;   // One per texture array
+        std::vector<uint8_t> show_faces;
+        FaceConnectivity connectivity;
+        size_t bytes;
+        
+        Entry() : hash(0), offset(0, 0, 0), connectivity(0), bytes(0) {}
+    };
+
+    std::list<Entry> lru;   // Most recently used first
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> index;
+    // Hashes of keys that have missed once
+    std::unordered_set<uint64_t> seen;
+    std::mutex cache_mutex;
+    std::atomic<size_t> used_bytes;
+
+    std::list<Entry>::iterator find(const Key& key);
+    void evict(size_t limit);
+
+public:
+    bool enabled;
+    size_t max_bytes;
+    // Forget which keys have missed once past this many
+    size_t max_seen;
+
+    std::atomic<size_t> hits, misses, evictions;
+
+    MeshCache();
+
+    // On a hit, copy the cached data for key into out, one RenderData per
+    // texture array, moved to offset, along with the chunk's visible faces
+    // (one byte per block) and connectivity
+    bool fetch(const Key& key, const BlockPos& offset, RenderData **out, size_t num_arrays,
+        uint8_t *show_faces, FaceConnectivity& connectivity);
+    // Keep a copy of freshly meshed data made at offset
+    void insert(const Key& key, const BlockPos& offset, RenderData **data, size_t num_arrays,
+        const uint8_t *show_faces, FaceConnectivity connectivity);
+    void clear();
+
+    size_t usedBytes() { return used_bytes; }
+    double hitRate() {
+        size_t total = hits + misses;
+        return total ? (double)hits / total : 0;
+    }
+};
+
+#endif
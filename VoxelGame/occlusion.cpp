@@ -0,0 +1,141 @@
+#include "occlusion.hpp"
+#include "chunkview.hpp"
+#include "facing.hpp"
+#include <string.h>
+
+// Faces of the chunk that a cell touches
+static int boundaryFaces(int index)
+{
+    int x, y, z;
+    Chunk::decodeIndex(index, x, y, z);
+    int faces = 0;
+    if (x == 0) faces |= facing::WEST_MASK;
+    if (x == 15) faces |= facing::EAST_MASK;
+    if (y == 0) faces |= facing::DOWN_MASK;
+    if (y == 15) faces |= facing::UP_MASK;
+    if (z == 0) faces |= facing::NORTH_MASK;
+    if (z == 15) faces |= facing::SOUTH_MASK;
+    return faces;
+}
+
+// stb_connected_components only handles 2D grids, so this is a plain 3D
+// flood fill. Each connected region of open cells connects every face it
+// touches to every other.
+FaceConnectivity OcclusionCuller::computeConnectivity(const bool *opaque)
+{
+    uint8_t visited[sizes::chunk_storage_size];
+    uint16_t stack[sizes::chunk_storage_size];
+    memset(visited, 0, sizeof(visited));
+
+    FaceConnectivity result = 0;
+    for (int start=0; start<sizes::chunk_storage_size; start++) {
+        if (opaque[start] || visited[start]) continue;
+
+        int faces = 0;
+        int sp = 0;
+        stack[sp++] = start;
+        visited[start] = 1;
+        while (sp) {
+            int index = stack[--sp];
+            int here = boundaryFaces(index);
+            faces |= here;
+
+            int x, y, z;
+            Chunk::decodeIndex(index, x, y, z);
+            for (int face=0; face<facing::NUM_FACES; face++) {
+                if (facing::hasFace(here, face)) continue;  // Leaves the chunk
+                const int *vec = facing::int_vector[face];
+                int n = Chunk::chunkBlockIndex(BlockPos(x+vec[0], y+vec[1], z+vec[2]));
+                if (opaque[n] || visited[n]) continue;
+                visited[n] = 1;
+                stack[sp++] = n;
+            }
+        }
+
+        for (int from=0; from<facing::NUM_FACES; from++) {
+            if (!facing::hasFace(faces, from)) continue;
+            for (int to=0; to<facing::NUM_FACES; to++) {
+                if (facing::hasFace(faces, to)) result |= FaceConnectivity(1) << (from * 6 + to);
+            }
+        }
+        if (result == ALL_FACES_CONNECTED) break;
+    }
+
+    return result;
+}
+
+void OcclusionCuller::cull(const std::vector<Chunk *>& loaded, const std::vector<Chunk *>& in_frustum,
+                           const ChunkPos& camera_chunk, std::vector<Chunk *>& visible)
+{
+    chunks_reached = 0;
+    if (!enabled || loaded.empty()) {
+        visible = in_frustum;
+        return;
+    }
+
+    // Dense grid over the loaded area, which is a box around the camera
+    int32_t maxX, maxY, maxZ;
+    minX = maxX = camera_chunk.X;
+    minY = maxY = camera_chunk.Y;
+    minZ = maxZ = camera_chunk.Z;
+    for (Chunk *chunk : loaded) {
+        const ChunkPos& cp(chunk->getChunkPos());
+        if (cp.X < minX) minX = cp.X;
+        if (cp.Y < minY) minY = cp.Y;
+        if (cp.Z < minZ) minZ = cp.Z;
+        if (cp.X > maxX) maxX = cp.X;
+        if (cp.Y > maxY) maxY = cp.Y;
+        if (cp.Z > maxZ) maxZ = cp.Z;
+    }
+    sizeX = maxX - minX + 1;
+    sizeY = maxY - minY + 1;
+    sizeZ = maxZ - minZ + 1;
+
+    size_t num_cells = (size_t)sizeX * sizeY * sizeZ;
+    grid.assign(num_cells, 0);
+    flags.assign(num_cells, 0);
+    for (Chunk *chunk : loaded) {
+        const ChunkPos& cp(chunk->getChunkPos());
+        grid[cellIndex(cp.X, cp.Y, cp.Z)] = chunk;
+    }
+    for (Chunk *chunk : in_frustum) {
+        const ChunkPos& cp(chunk->getChunkPos());
+        flags[cellIndex(cp.X, cp.Y, cp.Z)] |= IN_FRUSTUM;
+    }
+
+    int32_t start = cellIndex(camera_chunk.X, camera_chunk.Y, camera_chunk.Z);
+    if (!grid[start]) {
+        visible = in_frustum;
+        return;
+    }
+
+    visible.clear();
+    queue.clear();
+    queue.push_back(Step{start, -1, 0});
+    flags[start] |= VISITED;
+
+    // Visiting in queue order also gives the opaque pass a rough
+    // front-to-back order
+    for (size_t qi=0; qi<queue.size(); qi++) {
+        Step step = queue[qi];
+        Chunk *chunk = grid[step.cell];
+        chunks_reached++;
+        if (flags[step.cell] & IN_FRUSTUM) visible.push_back(chunk);
+
+        FaceConnectivity conn = chunk->getView()->getConnectivity();
+        const ChunkPos& cp(chunk->getChunkPos());
+        for (int dir=0; dir<facing::NUM_FACES; dir++) {
+            // Never head back toward the camera
+            if (facing::hasFace(step.directions, facing::oppositeFace(dir))) continue;
+            if (step.entry_face >= 0 && !facesConnected(conn, step.entry_face, dir)) continue;
+
+            const int *vec = facing::int_vector[dir];
+            int32_t n = cellIndex(cp.X + vec[0], cp.Y + vec[1], cp.Z + vec[2]);
+            if (n < 0 || !grid[n]) continue;
+            if ((flags[n] & VISITED) || !(flags[n] & IN_FRUSTUM)) continue;
+
+            flags[n] |= VISITED;
+            queue.push_back(Step{n, (int8_t)facing::oppositeFace(dir), (uint8_t)(step.directions | facing::bitmask(dir))});
+        }
+    }
+}
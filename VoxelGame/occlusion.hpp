@@ -0,0 +1,67 @@
+#ifndef INCLUDED_OCCLUSION_HPP
+#define INCLUDED_OCCLUSION_HPP
+
+#include <vector>
+#include <stdint.h>
+#include "position.hpp"
+
+class Chunk;
+
+/*
+Cave culling in the style of Tommaso Checchi's "Advanced Cave Culling
+Algorithm". Each chunk stores which of its six faces can see each other
+through non-opaque blocks. A breadth-first walk outward from the camera's
+chunk only crosses from one chunk into the next if the face it came in
+through is connected to the face it wants to leave by, and never turns back
+toward the camera. Chunks the walk doesn't reach are hidden behind terrain.
+*/
+
+// Bit (from * 6 + to) is set if face 'from' can see face 'to'
+typedef uint64_t FaceConnectivity;
+constexpr FaceConnectivity ALL_FACES_CONNECTED = (uint64_t(1) << 36) - 1;
+
+inline bool facesConnected(FaceConnectivity c, int from, int to) {
+    return (c >> (from * 6 + to)) & 1;
+}
+
+class OcclusionCuller {
+private:
+    enum { IN_FRUSTUM = 1, VISITED = 2 };
+
+    struct Step {
+        int32_t cell;
+        int8_t entry_face;      // -1 for the camera chunk
+        uint8_t directions;     // Directions traveled to get here
+    };
+
+    int32_t minX, minY, minZ;
+    int32_t sizeX, sizeY, sizeZ;
+    std::vector<Chunk *> grid;
+    std::vector<uint8_t> flags;
+    std::vector<Step> queue;
+
+    int32_t cellIndex(int32_t X, int32_t Y, int32_t Z) {
+        X -= minX; Y -= minY; Z -= minZ;
+        if (X < 0 || Y < 0 || Z < 0 || X >= sizeX || Y >= sizeY || Z >= sizeZ) return -1;
+        return X + sizeX * (Z + sizeZ * Y);
+    }
+
+public:
+    bool enabled;
+    int chunks_reached;
+
+    OcclusionCuller() : enabled(true), chunks_reached(0) {}
+
+    // Flood-fill the non-opaque cells of one chunk, given in chunk index
+    // order (see Chunk::chunkBlockIndex).
+    static FaceConnectivity computeConnectivity(const bool *opaque);
+
+    // Reduce the frustum-visible chunks to those reachable from the camera.
+    // loaded should contain every loaded chunk, in_frustum the subset that
+    // passed frustum culling. If the camera's chunk isn't loaded, nothing is
+    // culled.
+    void cull(const std::vector<Chunk *>& loaded, const std::vector<Chunk *>& in_frustum,
+              const ChunkPos& camera_chunk, std::vector<Chunk *>& visible);
+};
+
+#endif
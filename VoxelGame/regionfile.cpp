@@ -0,0 +1,431 @@
+#include "regionfile.hpp"
+#include "filelocator.hpp"
+#include "crc32c.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__APPLE__) || defined(__linux__)
+#include <unistd.h>
+#endif
+
+RegionFile::RegionFile() : file(0), sync(false)
+{
+    memset(table, 0, sizeof(table));
+}
+
+RegionFile::~RegionFile()
+{
+    close();
+}
+
+bool RegionFile::open(const std::string& fname)
+{
+    close();
+    memset(table, 0, sizeof(table));
+    sector_used.assign(header_sectors, true);
+
+    file = fopen(fname.c_str(), "r+b");
+    if (!file) {
+        if (!create(fname)) return false;
+        file = fopen(fname.c_str(), "r+b");
+        if (!file) return false;
+    }
+
+    uint32_t preamble[4];
+    bool ok = fread(preamble, sizeof(preamble), 1, file) == 1 && preamble[0] == magic && preamble[2] == num_chunks;
+    if (!ok || preamble[1] != version || fread(table, sizeof(table), 1, file) != 1) {
+        std::cout << "Bad region file " << fname << std::endl;
+        close();
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint32_t file_sectors = sectorsFor(ftell(file));
+    if (file_sectors > header_sectors) sector_used.resize(file_sectors, false);
+    for (int i=0; i<num_chunks; i++) {
+        Entry& e(table[i]);
+        if (!e.length) continue;
+        uint32_t count = sectorsFor(e.length);
+        if (e.sector < header_sectors || e.sector + count > file_sectors) {
+            std::cout << "Dropping chunk " << i << " past the end of " << fname << std::endl;
+            e.sector = 0;
+            e.length = 0;
+            continue;
+        }
+        for (uint32_t s=e.sector; s<e.sector+count; s++) sector_used[s] = true;
+    }
+    return true;
+}
+
+void RegionFile::close()
+{
+    if (file) {
+        fclose(file);
+        file = 0;
+    }
+}
+
+// An empty table, written under another name first so a crash can't leave
+// a file with half a header
+bool RegionFile::create(const std::string& fname)
+{
+    std::string temp = fname + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) return false;
+    uint32_t preamble[4] = { magic, version, num_chunks, 0 };
+    std::vector<char> header(header_sectors * sector_size, 0);
+    memcpy(header.data(), preamble, sizeof(preamble));
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size() && fflush(f) == 0;
+    fclose(f);
+
+    std::error_code ec;
+    if (ok) std::filesystem::rename(temp, fname, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+// First fit, or the end of the file
+uint32_t RegionFile::allocate(uint32_t count)
+{
+    uint32_t run = 0;
+    for (uint32_t s=header_sectors; s<sector_used.size(); s++) {
+        if (sector_used[s]) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            uint32_t first = s + 1 - count;
+            for (uint32_t t=first; t<=s; t++) sector_used[t] = true;
+            return first;
+        }
+    }
+    uint32_t first = sector_used.size();
+    sector_used.resize(first + count, true);
+    return first;
+}
+
+void RegionFile::release(uint32_t first, uint32_t count)
+{
+    for (uint32_t s=first; s<first+count && s<sector_used.size(); s++) sector_used[s] = false;
+}
+
+bool RegionFile::writeEntry(int index)
+{
+    if (fseek(file, table_offset + index * sizeof(Entry), SEEK_SET)) return false;
+    if (fwrite(&table[index], sizeof(Entry), 1, file) != 1) return false;
+    return syncFile();
+}
+
+// Flush, and fsync if asked to
+bool RegionFile::syncFile()
+{
+    if (fflush(file)) return false;
+#if defined(__APPLE__) || defined(__linux__)
+    if (sync && fsync(fileno(file))) return false;
+#endif
+    return true;
+}
+
+bool RegionFile::flush()
+{
+    if (!file || fflush(file)) return false;
+#if defined(__APPLE__) || defined(__linux__)
+    if (fsync(fileno(file))) return false;
+#endif
+    return true;
+}
+
+bool RegionFile::readChunk(int index, std::vector<char>& data)
+{
+    const Entry& e(table[index]);
+    if (!file || !e.length) return false;
+    // Keeps its capacity, so a reused buffer only grows
+    data.resize(e.length);
+#if defined(__APPLE__) || defined(__linux__)
+    // Straight into data, without going through the stdio buffer. Writes
+    // are always flushed, so there's nothing in it to miss.
+    if (pread(fileno(file), data.data(), e.length, (off_t)e.sector * sector_size) != (ssize_t)e.length) return false;
+#else
+    if (fseek(file, (long)e.sector * sector_size, SEEK_SET)) return false;
+    if (fread(data.data(), 1, e.length, file) != e.length) return false;
+#endif
+    if (crc32c(data.data(), e.length) != e.crc) {
+        std::cout << "Bad checksum for chunk " << index << " in region file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool RegionFile::writeChunk(int index, const char *data, size_t length)
+{
+    if (!file || !length) return false;
+    uint32_t count = sectorsFor(length);
+    // Somewhere other than the current copy, which stays until the table
+    // points at the new one
+    uint32_t first = allocate(count);
+
+    // Pad out the last sector so the file stays a whole number of them
+    static const char zeros[sector_size] = {0};
+    size_t padding = count * sector_size - length;
+    if (fseek(file, (long)first * sector_size, SEEK_SET) ||
+        fwrite(data, 1, length, file) != length ||
+        fwrite(zeros, 1, padding, file) != padding ||
+        !syncFile()) {
+        std::cout << "Unable to write chunk " << index << " to region file\n";
+        release(first, count);
+        return false;
+    }
+
+    Entry& e(table[index]);
+    Entry old = e;
+    e.sector = first;
+    e.length = length;
+    e.crc = crc32c(data, length);
+    e.unused = 0;
+    if (!writeEntry(index)) {
+        // XXX the entry may be half written; the CRC catches that on load
+        std::cout << "Unable to update region table for chunk " << index << std::endl;
+        e = old;
+        release(first, count);
+        return false;
+    }
+    if (old.length) release(old.sector, sectorsFor(old.length));
+    return true;
+}
+
+static bool parse_chunk_coords(const char *str, int *arr)
+{
+    while (*str && *str!='(') str++;
+    if (*str != '(') return false;
+    str++;
+    arr[0] = atoi(str);
+
+    while (*str && *str!=',') str++;
+    if (*str != ',') return false;
+    str++;
+    arr[1] = atoi(str);
+
+    while (*str && *str!=',') str++;
+    if (*str != ',') return false;
+    str++;
+    arr[2] = atoi(str);
+
+    return true;
+}
+
+RegionStore RegionStore::instance;
+
+RegionStore::RegionStore() : use_count(0), converted(false), scanned(false), max_open(32), sync_writes(false) {}
+
+RegionStore::~RegionStore()
+{
+    closeAll();
+}
+
+std::string RegionStore::regionName(const ChunkPos& rp)
+{
+    return "region(" + std::to_string(rp.X) + "," + std::to_string(rp.Y) + "," + std::to_string(rp.Z) + ")";
+}
+
+RegionFile *RegionStore::getRegion(const ChunkPos& rp, bool create)
+{
+    auto i = regions.find(rp.packed());
+    if (i != regions.end()) {
+        i->second.last_used = ++use_count;
+        return i->second.file;
+    }
+
+    std::string fname = FileLocator::instance.chunk(regionName(rp));
+    if (!create && !FileLocator::file_exists(fname)) return 0;
+    if (create) {
+        std::error_code ec;
+        std::filesystem::create_directories(FileLocator::instance.chunk(""), ec);
+    }
+
+    RegionFile *file = new RegionFile;
+    if (!file->open(fname)) {
+        delete file;
+        return 0;
+    }
+
+    if (regions.size() >= max_open) {
+        auto oldest = regions.begin();
+        for (auto j=regions.begin(); j!=regions.end(); ++j) {
+            if (j->second.last_used < oldest->second.last_used) oldest = j;
+        }
+        delete oldest->second.file;
+        regions.erase(oldest);
+    }
+    regions[rp.packed()] = OpenRegion{file, ++use_count};
+
+    StoredChunks& sc(stored[rp.packed()]);
+    sc.rp = rp;
+    sc.known = true;
+    for (int j=0; j<RegionFile::num_chunks; j++) sc.bits[j] = file->hasChunk(j);
+    return file;
+}
+
+// Every region file there is, without opening any
+void RegionStore::scanUnlocked()
+{
+    if (scanned) return;
+    scanned = true;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(FileLocator::instance.chunk(""), ec)) {
+        std::string name = entry.path().filename().string();
+        int xyz[3];
+        if (name.compare(0, 7, "region(") || name.back() != ')' || !parse_chunk_coords(name.c_str(), xyz)) continue;
+        ChunkPos rp(xyz[0], xyz[1], xyz[2]);
+        // Those already open are known
+        auto i = stored.try_emplace(rp.packed()).first;
+        i->second.rp = rp;
+    }
+}
+
+// Null if there's no file for the region
+RegionStore::StoredChunks *RegionStore::storedChunksUnlocked(const ChunkPos& rp)
+{
+    auto i = stored.find(rp.packed());
+    if (i == stored.end()) return 0;
+    if (!i->second.known) {
+        // Fills in the bits
+        if (!getRegion(rp, false)) {
+            // Unreadable, so as good as empty
+            i->second.known = true;
+            i->second.bits.reset();
+        }
+    }
+    return &i->second;
+}
+
+bool RegionStore::hasChunkUnlocked(const ChunkPos& cp)
+{
+    convertChunkFilesUnlocked();
+    scanUnlocked();
+    StoredChunks *sc = storedChunksUnlocked(RegionFile::regionPos(cp));
+    return sc && sc->bits[RegionFile::chunkIndex(cp)];
+}
+
+bool RegionStore::hasChunk(const ChunkPos& cp)
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    return hasChunkUnlocked(cp);
+}
+
+void RegionStore::listChunks(const ChunkPos& lo, const ChunkPos& hi, std::vector<ChunkPos>& chunks)
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    convertChunkFilesUnlocked();
+    scanUnlocked();
+    ChunkPos rlo = RegionFile::regionPos(lo), rhi = RegionFile::regionPos(hi);
+    const int size = RegionFile::region_size;
+    for (auto i=stored.begin(); i!=stored.end(); ++i) {
+        ChunkPos rp = i->second.rp;
+        if (rp.X < rlo.X || rp.X > rhi.X || rp.Y < rlo.Y || rp.Y > rhi.Y || rp.Z < rlo.Z || rp.Z > rhi.Z) continue;
+        StoredChunks *sc = storedChunksUnlocked(rp);
+        for (int j=0; j<RegionFile::num_chunks; j++) {
+            if (!sc->bits[j]) continue;
+            // See RegionFile::chunkIndex
+            ChunkPos cp(rp.X * size + (j & (size-1)),
+                        rp.Y * size + (j >> (2*RegionFile::region_bits)),
+                        rp.Z * size + ((j >> RegionFile::region_bits) & (size-1)));
+            if (cp.X < lo.X || cp.X > hi.X || cp.Y < lo.Y || cp.Y > hi.Y || cp.Z < lo.Z || cp.Z > hi.Z) continue;
+            chunks.push_back(cp);
+        }
+    }
+}
+
+bool RegionStore::readChunk(const ChunkPos& cp, std::vector<char>& data)
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    // Most chunks asked for that were never saved end here, without a syscall
+    if (!hasChunkUnlocked(cp)) return false;
+    RegionFile *file = getRegion(RegionFile::regionPos(cp), false);
+    if (!file) return false;
+    return file->readChunk(RegionFile::chunkIndex(cp), data);
+}
+
+bool RegionStore::writeChunk(const ChunkPos& cp, const char *data, size_t length)
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    convertChunkFilesUnlocked();
+    RegionFile *file = getRegion(RegionFile::regionPos(cp), true);
+    if (!file) return false;
+    file->sync = sync_writes;
+    int index = RegionFile::chunkIndex(cp);
+    if (!file->writeChunk(index, data, length)) return false;
+    stored[RegionFile::regionPos(cp).packed()].bits.set(index);
+    return true;
+}
+
+bool RegionStore::syncAll()
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    bool ok = true;
+    for (auto i=regions.begin(); i!=regions.end(); ++i) {
+        if (!i->second.file->flush()) ok = false;
+    }
+    return ok;
+}
+
+void RegionStore::closeAll()
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    for (auto i=regions.begin(); i!=regions.end(); ++i) delete i->second.file;
+    regions.clear();
+    stored.clear();
+    converted = false;
+    scanned = false;
+}
+
+void RegionStore::convertChunkFiles()
+{
+    std::unique_lock<std::mutex> lock(store_mutex);
+    convertChunkFilesUnlocked();
+}
+
+void RegionStore::convertChunkFilesUnlocked()
+{
+    if (converted) return;
+    converted = true;
+
+    std::string dir = FileLocator::instance.chunk("");
+    std::error_code ec;
+    if (!std::filesystem::is_directory(dir, ec)) return;
+
+    std::vector<std::filesystem::path> old_files;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().filename().string().compare(0, 6, "chunk(") == 0) old_files.push_back(entry.path());
+    }
+    if (old_files.empty()) return;
+
+    std::cout << "Converting " << old_files.size() << " chunk files to regions" << std::endl;
+    size_t converted_count = 0;
+    for (const std::filesystem::path& path : old_files) {
+        int xyz[3];
+        if (!parse_chunk_coords(path.filename().string().c_str(), xyz)) continue;
+        ChunkPos cp(xyz[0], xyz[1], xyz[2]);
+
+        std::ifstream rf(path, std::ios::binary);
+        if (!rf.good()) continue;
+        std::vector<char> data((std::istreambuf_iterator<char>(rf)), std::istreambuf_iterator<char>());
+        rf.close();
+
+        RegionFile *file = getRegion(RegionFile::regionPos(cp), true);
+        if (!file) continue;
+        int index = RegionFile::chunkIndex(cp);
+        // Anything already in a region was saved after the old file
+        if (!file->hasChunk(index) && !file->writeChunk(index, data.data(), data.size())) continue;
+        stored[RegionFile::regionPos(cp).packed()].bits.set(index);
+        std::filesystem::remove(path, ec);
+        converted_count++;
+    }
+    std::cout << "Converted " << converted_count << " chunks" << std::endl;
+}
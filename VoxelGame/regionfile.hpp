@@ -0,0 +1,157 @@
+#ifndef INCLUDED_REGION_FILE_HPP
+#define INCLUDED_REGION_FILE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <bitset>
+#include <mutex>
+#include "position.hpp"
+
+/*
+Saved chunks are grouped into region files of 16x16x16 chunks each, so
+what's loaded at once comes out of a handful of files that stay open.
+
+A region file starts with a table giving each chunk's first sector, its
+length in bytes and a CRC of the data. Chunk data follows in 4KB sectors.
+Chunks are never rewritten in place: a new copy goes into the first run of
+free sectors big enough to hold it, or at the end of the file, and only once
+that's written does the table entry move to it and the old sectors become
+free. A crash part way through leaves the old copy, and a chunk that was
+damaged anyway fails its CRC rather than loading garbage.
+*/
+class RegionFile {
+public:
+    static constexpr int region_bits = 4;
+    static constexpr int region_size = 1 << region_bits;   // Chunks per side
+    static constexpr int num_chunks = region_size * region_size * region_size;
+    static constexpr size_t sector_size = 4096;
+    static constexpr uint32_t magic = 0x46524756;   // "VGRF"
+    static constexpr uint32_t version = 1;
+
+private:
+    // 16 bytes, so no entry straddles a sector
+    struct Entry {
+        uint32_t sector;    // First sector, 0 if the chunk isn't stored
+        uint32_t length;    // Bytes
+        uint32_t crc;
+        uint32_t unused;
+    };
+
+    static constexpr size_t table_offset = 16;
+    static constexpr uint32_t header_sectors =
+        (table_offset + num_chunks * sizeof(Entry) + sector_size - 1) / sector_size;
+
+    FILE *file;
+    Entry table[num_chunks];
+    std::vector<bool> sector_used;
+
+    static uint32_t sectorsFor(size_t bytes) { return (bytes + sector_size - 1) / sector_size; }
+    uint32_t allocate(uint32_t count);
+    void release(uint32_t first, uint32_t count);
+    bool writeEntry(int index);
+    bool syncFile();
+    static bool create(const std::string& fname);
+
+public:
+    // fsync after writing chunk data and again after the table, so the
+    // table never points at data that isn't on the disk yet. Without it a
+    // crash of the game is safe, but losing power may not be.
+    bool sync;
+
+    RegionFile();
+    ~RegionFile();
+
+    // Opens, or creates, the file. Entries pointing past the end of the file
+    // are dropped.
+    bool open(const std::string& fname);
+    void close();
+
+    // Region a chunk belongs to, and its index there (x | z<<4 | y<<8, like
+    // block indices within a chunk)
+    static ChunkPos regionPos(const ChunkPos& cp) {
+        return ChunkPos(cp.X >> region_bits, cp.Y >> region_bits, cp.Z >> region_bits);
+    }
+    static int chunkIndex(const ChunkPos& cp) {
+        const int mask = region_size - 1;
+        return (cp.X & mask) | (cp.Z & mask) << region_bits | (cp.Y & mask) << (2*region_bits);
+    }
+
+    bool hasChunk(int index) { return table[index].length != 0; }
+    bool readChunk(int index, std::vector<char>& data);
+    bool writeChunk(int index, const char *data, size_t length);
+
+    size_t numSectors() { return sector_used.size(); }
+    // fflush and fsync, whatever sync says
+    bool flush();
+};
+
+/*
+Open region files, for the whole storage directory.
+
+It also keeps a bitmap of the chunks stored in each region file, closed or
+not, so asking for a chunk that was never saved is answered from memory
+instead of by opening or even looking for a file. The directory is listed
+once, on first use, and a file's bitmap is filled in from its table the
+first time that region is asked about; after that saves keep it current.
+*/
+class RegionStore {
+public:
+    static RegionStore instance;
+
+private:
+    struct OpenRegion {
+        RegionFile *file;
+        uint64_t last_used;
+    };
+
+    struct StoredChunks {
+        ChunkPos rp;
+        bool known;     // bits has been read from the file
+        std::bitset<RegionFile::num_chunks> bits;
+    };
+
+    std::mutex store_mutex;
+    std::unordered_map<uint64_t, OpenRegion> regions;
+    std::unordered_map<uint64_t, StoredChunks> stored;
+    uint64_t use_count;
+    bool converted, scanned;
+
+    RegionFile *getRegion(const ChunkPos& rp, bool create);
+    void convertChunkFilesUnlocked();
+    void scanUnlocked();
+    StoredChunks *storedChunksUnlocked(const ChunkPos& rp);
+    bool hasChunkUnlocked(const ChunkPos& cp);
+
+public:
+    // Least recently used files are closed past this many
+    size_t max_open;
+    // See RegionFile::sync
+    bool sync_writes;
+
+    RegionStore();
+    ~RegionStore();
+
+    static std::string regionName(const ChunkPos& rp);
+
+    // Whether the chunk is in a region file. Saves still queued (see
+    // SaveQueue) aren't there yet.
+    bool hasChunk(const ChunkPos& cp);
+    // Every stored chunk from lo to hi, inclusive, in no particular order
+    void listChunks(const ChunkPos& lo, const ChunkPos& hi, std::vector<ChunkPos>& chunks);
+
+    bool readChunk(const ChunkPos& cp, std::vector<char>& data);
+    bool writeChunk(const ChunkPos& cp, const char *data, size_t length);
+    // Flush every open file to disk
+    bool syncAll();
+    // Close everything, e.g. before switching storage directories
+    void closeAll();
+
+    // Move chunks saved one per file by older versions into regions,
+    // deleting the old files. Done once, before the first read or write.
+    void convertChunkFiles();
+};
+
+#endif
@@ -23,6 +23,87 @@ void Renderer::deallocate()
         glDeleteVertexArrays(1, &VAO);
         VAO = 0;
     }
+    GeometryArena::instance.free(range);
+}
+
+VertexPool VertexPool::instance;
+
+void VertexPool::reserve(std::vector<float>& v, size_t floats)
+{
+    if (v.capacity() >= floats) return;
+    if (!v.empty()) {
+        // Rare: a render grew past what was counted for it
+        v.reserve(floats);
+        return;
+    }
+    release(v);
+    
+    int c = min_class;
+    while (c < min_class + num_classes - 1 && (size_t(1) << c) < floats) c++;
+    
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        std::vector<std::vector<float>>& list(free_list[c - min_class]);
+        if (!list.empty()) {
+            v.swap(list.back());
+            list.pop_back();
+            pooled_bytes -= v.capacity() * sizeof(float);
+            hits++;
+            return;
+        }
+        misses++;
+    }
+    v.reserve(size_t(1) << c);
+}
+
+void VertexPool::release(std::vector<float>& v)
+{
+    size_t cap = v.capacity();
+    if (cap < (size_t(1) << min_class)) {
+        std::vector<float>().swap(v);
+        return;
+    }
+    
+    // Largest class this buffer can satisfy
+    int c = min_class;
+    while (c < min_class + num_classes - 1 && (size_t(1) << (c+1)) <= cap) c++;
+    
+    v.clear();
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (pooled_bytes + cap * sizeof(float) > max_pooled_bytes) {
+        lock.unlock();
+        std::vector<float>().swap(v);
+        return;
+    }
+    std::vector<std::vector<float>>& list(free_list[c - min_class]);
+    list.push_back(std::vector<float>());
+    list.back().swap(v);
+    pooled_bytes += cap * sizeof(float);
+}
+
+QuadIndexBuffer QuadIndexBuffer::instance;
+
+void QuadIndexBuffer::bind(size_t quads)
+{
+    if (!EBO) glGenBuffers(1, &EBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    if (quads <= num_quads) return;
+    
+    size_t n = num_quads ? num_quads : 16384;
+    while (n < quads) n *= 2;
+    
+    std::vector<uint32_t> indices(n * 6);
+    for (size_t i=0; i<n; i++) {
+        uint32_t v = i * 4;
+        indices[i*6+0] = v;
+        indices[i*6+1] = v+1;
+        indices[i*6+2] = v+2;
+        indices[i*6+3] = v;
+        indices[i*6+4] = v+2;
+        indices[i*6+5] = v+3;
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+    num_quads = n;
 }
 
 void RenderData::clear()
@@ -33,6 +114,21 @@ void RenderData::clear()
     total_vertices = 0;
 }
 
+void RenderData::reserve(int num_vertices)
+{
+    size_t n = total_vertices + num_vertices;
+    VertexPool::instance.reserve(vertices, n * 3);
+    VertexPool::instance.reserve(texcoords, n * texcoord_size);
+    VertexPool::instance.reserve(normals, n * 3);
+}
+
+void RenderData::release()
+{
+    VertexPool::instance.release(vertices);
+    VertexPool::instance.release(texcoords);
+    VertexPool::instance.release(normals);
+}
+
 void RenderBuffer::load(unsigned int VAO, const std::vector<float>& list)
 {
     glBindVertexArray(VAO);
@@ -52,23 +148,53 @@ void Renderer::load_buffers()
     if (!needs_load) return;
     needs_load = false;
     
+    if (tex_array) {
+        GeometryArena::instance.free(range);
+        range = GeometryArena::instance.upload(data);
+        data.release();
+        return;
+    }
+    
     // std::cout << "Loading buffers" << std::endl;
     if (!VAO) glGenVertexArrays(1, &VAO);
     vertex_buffer.load(VAO, data.vertices);
     texcoord_buffer.load(VAO, data.texcoords);
     normals_buffer.load(VAO, data.normals);
+    
+    glBindVertexArray(VAO);
+    QuadIndexBuffer::instance.bind(data.total_vertices / 4);
+    glBindVertexArray(0);
+    
+    // The GL has its own copy now
+    data.release();
 }
 
 void Renderer::draw(Shader *shader)
 {
     // std::cout << "draw tv=" << data.total_vertices << " VAO=" << VAO << std::endl;
+    if (tex_array) {
+        if (!range.valid()) return;
+        GeometryArena::instance.bindPage(range.page);
+        shader->use();
+        tex_array->use(0);
+        glDrawElementsBaseVertex(GL_TRIANGLES, QuadIndexBuffer::numIndices(range.count), GL_UNSIGNED_INT, (void*)0, range.first);
+        glBindVertexArray(0);
+        return;
+    }
+    
     glBindVertexArray(VAO);
     shader->use();
     tex->use(0);
-    glDrawArrays(GL_TRIANGLES, 0, data.total_vertices);
+    glDrawElements(GL_TRIANGLES, QuadIndexBuffer::numIndices(data.total_vertices), GL_UNSIGNED_INT, (void*)0);
     glBindVertexArray(0);
 }
 
+void Renderer::addDraw(DrawList& list, Shader *shader)
+{
+    load_buffers();
+    if (range.valid()) list.add(shader, tex_array, center, range.page, range.first, range.count);
+}
+
 
 
 RenderManager RenderManager::instance;
@@ -208,10 +334,11 @@ void RenderManager::stop()
 void RenderManager::deleteDeadRendererQueue()
 {
     std::unique_lock<std::mutex> lock(dead_renderer_mutex);
-    for (auto i=dead_renderers.begin(); i!=dead_renderers.end(); ++i) {
+    for (auto i=dying_renderers.begin(); i!=dying_renderers.end(); ++i) {
         delete *i;
     }
-    dead_renderers.clear();
+    dying_renderers.clear();
+    dying_renderers.swap(dead_renderers);
 }
 
 void RenderManager::queueDeleteRenderer(const std::vector<Renderer *>& r) {
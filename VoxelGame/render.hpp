@@ -8,16 +8,86 @@
 #include "texture.hpp"
 #include "shader.hpp"
 #include "position.hpp"
+#include "geometryarena.hpp"
 
 class CameraModel;
 
+/*
+Recycles the float vectors that hold meshing output. Capacity is handed out
+in power-of-two size classes, so a buffer given back by one chunk fits the
+next chunk of a similar size. Renderers give their buffers back once the
+data is uploaded, so chunks don't keep a CPU copy of everything they draw.
+Used from both the compute and graphics threads.
+*/
+class VertexPool {
+public:
+    static VertexPool instance;
+    
+private:
+    static constexpr int min_class = 8;     // 256 floats
+    static constexpr int num_classes = 28;
+    
+    std::mutex pool_mutex;
+    std::vector<std::vector<float>> free_list[num_classes];
+    size_t pooled_bytes;
+    
+public:
+    // Buffers beyond this are freed instead of pooled
+    size_t max_pooled_bytes;
+    size_t hits, misses;
+    
+    VertexPool() : pooled_bytes(0), max_pooled_bytes(64 << 20), hits(0), misses(0) {}
+    
+    // Make sure v can hold at least this many floats. An empty v is replaced
+    // by a buffer from the pool.
+    void reserve(std::vector<float>& v, size_t floats);
+    // Take v's buffer, leaving v empty with no capacity
+    void release(std::vector<float>& v);
+    
+    size_t pooledBytes() { return pooled_bytes; }
+};
+
+/*
+Meshes come out as quads of 4 vertices each (see Face::getQuadVertices), so
+every renderer can share one index buffer with triangles 0-1-2 and 0-2-3 for
+each quad. It grows to fit the biggest renderer loaded so far, keeping the
+same buffer name so VAOs that already refer to it stay valid. Graphics thread
+only.
+*/
+class QuadIndexBuffer {
+public:
+    static QuadIndexBuffer instance;
+    
+private:
+    unsigned int EBO;
+    size_t num_quads;
+    
+public:
+    QuadIndexBuffer() : EBO(0), num_quads(0) {}
+    
+    // Attach to the currently bound VAO, making sure there are indices for
+    // at least this many quads
+    void bind(size_t quads);
+    
+    static int numIndices(int num_vertices) { return num_vertices / 4 * 6; }
+};
+
 struct RenderData {
     std::vector<float> vertices, texcoords, normals;
+    // Always a multiple of 4, one quad per 4 vertices
     int total_vertices;
+    // Floats per texcoord: 2, or 3 when drawing from a TextureArray
+    int texcoord_size;
     
     void clear();
-    
-    RenderData() : total_vertices(0) {}
+    // Size the buffers for this many more vertices
+    void reserve(int num_vertices);
+    // Give the buffers back to VertexPool. total_vertices is kept, since
+    // it's still needed for drawing after the data has been uploaded.
+    void release();
+    
+    RenderData(int tcs = 2) : total_vertices(0), texcoord_size(tcs) {}
+    ~RenderData() { release(); }
 };
 
 struct RenderBuffer {
@@ -27,7 +97,7 @@ struct RenderBuffer {
     RenderBuffer() : VBO(0) {}
     ~RenderBuffer() { deallocate(); }
     
-    RenderBuffer(int an, int nc) : attribute_number(an), num_components(nc), VBO(0) {}
+    RenderBuffer(int an, int nc) : attribute_number(an), VBO(0), num_components(nc) {}
     void load(unsigned int VAO, const std::vector<float>& list);
     void deallocate();
 };
@@ -36,9 +106,13 @@ class Renderer {
 private:
     unsigned int VAO;
     Texture *tex;
+    TextureArray *tex_array;
     // Shader *shader;
     RenderData data;
     RenderBuffer vertex_buffer, texcoord_buffer, normals_buffer;
+    // Texture array renderers keep their geometry in GeometryArena
+    // instead of the buffers above
+    GeometryArena::Range range;
     BlockPos center;
     bool needs_load;
     
@@ -49,14 +123,22 @@ public:
     // double current_time, target_time;
     
 public:
-    Renderer(Texture *t) : tex(t), VAO(0), needs_load(false),
-        vertex_buffer(0, 3), texcoord_buffer(2, 2), normals_buffer(1, 3) {}
+    Renderer(Texture *t) : VAO(0), tex(t), tex_array(0),
+        vertex_buffer(0, 3), texcoord_buffer(2, 2), normals_buffer(1, 3), needs_load(false) {}
+    // Texcoords are (u, v, layer) into the array
+    Renderer(TextureArray *a) : VAO(0), tex(0), tex_array(a), data(3),
+        vertex_buffer(0, 3), texcoord_buffer(2, 3), normals_buffer(1, 3), needs_load(false) {}
     ~Renderer() { deallocate(); }
     void deallocate();
     
     // void clearData() { data.clear(); }
     void load_buffers();
     void draw(Shader *shader);
+    // Give back the arena range until there is new data to load
+    void unload() { GeometryArena::instance.free(range); }
+    // Queue an arena draw instead of drawing now. Texture array renderers
+    // only.
+    void addDraw(DrawList& list, Shader *shader);
     
     
     void setCenter(const BlockPos& c) { center = c; }
@@ -93,7 +175,9 @@ private:
     bool entities_needs_compute;
     volatile bool entities_thread_alive;
     
-    std::vector<Renderer*> dead_renderers;
+    // Renderers queued since the last frame ended, and those queued the
+    // frame before, which nothing on the graphics thread can still be using
+    std::vector<Renderer*> dead_renderers, dying_renderers;
     std::mutex             dead_renderer_mutex;
     
     void chunks_thread_loop();
@@ -119,6 +203,8 @@ public:
     
     void queueDeleteRenderer(const std::vector<Renderer*>& r);
     void queueDeleteRenderer(Renderer* r);
+    // Call from the graphics thread once per frame. Renderers are deleted
+    // one frame after the one they were queued in.
     void deleteDeadRendererQueue();
 };
 
@@ -0,0 +1,213 @@
+#include "savequeue.hpp"
+#include "regionfile.hpp"
+#include "time.hpp"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+
+SaveQueue SaveQueue::instance;
+
+// Tries at writing a chunk before giving up, and the pause after a batch
+// with failures so a full disk isn't hammered
+static const int max_attempts = 3;
+static const std::chrono::milliseconds retry_delay(100);
+
+SaveQueue::SaveQueue() : num_submitted(0), num_written(0), running(false), stopping(false),
+    num_workers(0), max_batch(64), sync_policy(SYNC_BATCH) {}
+
+SaveQueue::~SaveQueue()
+{
+    stop();
+    for (Job *job : spare_jobs) delete job;
+}
+
+void SaveQueue::startUnlocked()
+{
+    int n = num_workers;
+    if (n < 1) {
+        n = std::thread::hardware_concurrency();
+        if (n > 4) n = 4;
+        if (n < 1) n = 1;
+    }
+    running = true;
+    stopping = false;
+    for (int i=0; i<n; i++) workers.emplace_back(&SaveQueue::workerLoop, this);
+    writer = std::thread(&SaveQueue::writerLoop, this);
+}
+
+void SaveQueue::submit(Chunk *chunk)
+{
+    if (!chunk->needs_save) return;
+
+    Job *job;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!running) startUnlocked();
+        if (spare_jobs.empty()) {
+            job = new Job;
+        } else {
+            job = spare_jobs.back();
+            spare_jobs.pop_back();
+        }
+    }
+
+    // The copy is made outside the lock, so workers aren't held up by it
+    chunk->snapshot(job->snap);
+    job->packed = job->snap.chunk_pos.packed();
+    job->attempts = 0;
+    job->failed = false;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    job->seq = ++num_submitted;
+    unwritten.insert(job->seq);
+    pending[job->packed]++;
+    to_serialize.push_back(job);
+    work_ready.notify_one();
+}
+
+void SaveQueue::workerLoop()
+{
+    for (;;) {
+        Job *job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            work_ready.wait(lock, [this] { return stopping || !to_serialize.empty(); });
+            if (to_serialize.empty()) return;
+            job = to_serialize.front();
+            to_serialize.pop_front();
+        }
+
+        job->bytes.clear();
+        job->snap.serialize(job->bytes);
+
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        to_write.push_back(job);
+        write_ready.notify_one();
+    }
+}
+
+void SaveQueue::writerLoop()
+{
+    std::vector<Job *> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            write_ready.wait(lock, [this] { return !to_write.empty() || (stopping && to_serialize.empty() && num_written == num_submitted); });
+            if (to_write.empty()) return;
+            while (!to_write.empty() && batch.size() < max_batch) {
+                batch.push_back(to_write.front());
+                to_write.pop_front();
+            }
+        }
+
+        // By region, then by place in the region, then oldest first, so the
+        // last of each chunk's copies is the one to write
+        std::sort(batch.begin(), batch.end(), [](const Job *a, const Job *b) {
+            uint64_t ra = RegionFile::regionPos(a->snap.chunk_pos).packed();
+            uint64_t rb = RegionFile::regionPos(b->snap.chunk_pos).packed();
+            if (ra != rb) return ra < rb;
+            if (a->packed != b->packed) return a->packed < b->packed;
+            return a->seq < b->seq;
+        });
+
+        RegionStore::instance.sync_writes = (sync_policy == SYNC_EACH);
+        for (size_t i=0; i<batch.size(); i++) {
+            Job *job = batch[i];
+            if (i+1 < batch.size() && batch[i+1]->packed == job->packed) continue;
+            uint64_t newest;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                uint64_t& n(newest_written[job->packed]);
+                newest = n;
+                if (job->seq > n) n = job->seq;
+            }
+            // A newer copy from another batch got here first
+            if (job->seq < newest) continue;
+            job->failed = !RegionStore::instance.writeChunk(job->snap.chunk_pos, job->bytes.data(), job->bytes.size());
+        }
+        if (sync_policy == SYNC_BATCH) RegionStore::instance.syncAll();
+
+        bool retrying = false;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            for (Job *job : batch) {
+                if (job->failed) {
+                    job->failed = false;
+                    if (++job->attempts < max_attempts) {
+                        // Still pending, and still the newest copy
+                        to_write.push_back(job);
+                        retrying = true;
+                        continue;
+                    }
+                    std::cout << "Unable to save chunk " << job->snap.chunk_pos.toString() << std::endl;
+                    failed_seqs.insert(job->seq);
+                    failed_chunks.push_back(job->snap.chunk_pos);
+                }
+                auto p = pending.find(job->packed);
+                if (--p->second == 0) {
+                    pending.erase(p);
+                    newest_written.erase(job->packed);
+                }
+                unwritten.erase(job->seq);
+                spare_jobs.push_back(job);
+                num_written++;
+            }
+            batch.clear();
+            written.notify_all();
+        }
+        if (retrying) std::this_thread::sleep_for(retry_delay);
+    }
+}
+
+bool SaveQueue::flush(bool progress)
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    uint64_t target = num_submitted;
+    auto remaining = [this, target] { return (size_t)std::distance(unwritten.begin(), unwritten.upper_bound(target)); };
+    size_t total = remaining();
+    while (!unwritten.empty() && *unwritten.begin() <= target) {
+        written.wait_for(lock, std::chrono::milliseconds(500));
+        size_t left = remaining();
+        if (progress && left) {
+            std::cout << "Saved " << (total - left) << " of " << total << " chunks" << std::endl;
+        }
+    }
+
+    bool ok = failed_seqs.empty() || *failed_seqs.begin() > target;
+    failed_seqs.erase(failed_seqs.begin(), failed_seqs.upper_bound(target));
+    return ok;
+}
+
+void SaveQueue::takeFailed(std::vector<ChunkPos>& chunks)
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    chunks.swap(failed_chunks);
+    failed_chunks.clear();
+}
+
+void SaveQueue::waitFor(const ChunkPos& cp)
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    uint64_t packed = cp.packed();
+    written.wait(lock, [this, packed] { return pending.find(packed) == pending.end(); });
+}
+
+void SaveQueue::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!running) return;
+        stopping = true;
+        work_ready.notify_all();
+        write_ready.notify_all();
+    }
+    for (std::thread& t : workers) t.join();
+    workers.clear();
+    {
+        // The workers are gone, so the writer can tell when it's done
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        write_ready.notify_all();
+    }
+    writer.join();
+    running = false;
+}
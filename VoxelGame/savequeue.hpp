@@ -0,0 +1,96 @@
+#ifndef INCLUDED_SAVE_QUEUE_HPP
+#define INCLUDED_SAVE_QUEUE_HPP
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "chunk.hpp"
+
+/*
+Saves chunks in the background. submit copies the chunk (see ChunkSnapshot),
+which is all the caller waits for. Worker threads serialize the copies, and
+one writer thread stores them, a batch at a time, sorted so chunks in the
+same region file are written together.
+
+If a chunk is submitted again before the first copy is written, only the
+newest copy is written. Chunk::load waits for anything still queued for
+its chunk, so it never reads an older version from disk.
+
+A copy that can't be written is tried again with a later batch, a few
+times, and then given up on. flush reports that, and takeFailed says which
+chunks they were, so the caller can mark them modified again.
+
+Threads are started by the first submit and run until stop.
+*/
+class SaveQueue {
+public:
+    static SaveQueue instance;
+
+    enum SyncPolicy {
+        SYNC_NONE,      // Leave it to the OS. A crash of the game is still safe.
+        SYNC_BATCH,     // fsync region files after each batch
+        SYNC_EACH       // fsync each chunk, and its table entry after it
+    };
+
+private:
+    struct Job {
+        uint64_t seq;
+        uint64_t packed;    // ChunkPos::packed
+        ChunkSnapshot snap;
+        ByteWriter bytes;
+        int attempts;
+        bool failed;        // The last attempt
+    };
+
+    std::mutex queue_mutex;
+    std::condition_variable work_ready, write_ready, written;
+    std::deque<Job *> to_serialize, to_write;
+    std::vector<Job *> spare_jobs;
+    // Per chunk: copies submitted and not yet written, and the newest
+    // written while any are
+    std::unordered_map<uint64_t, int> pending;
+    std::unordered_map<uint64_t, uint64_t> newest_written;
+    uint64_t num_submitted, num_written;
+    // Jobs are written out of order, so flush waits on the oldest of these
+    std::set<uint64_t> unwritten;
+    // Given up on, until flush or takeFailed reports them
+    std::set<uint64_t> failed_seqs;
+    std::vector<ChunkPos> failed_chunks;
+
+    std::vector<std::thread> workers;
+    std::thread writer;
+    bool running, stopping;
+
+    void startUnlocked();
+    void workerLoop();
+    void writerLoop();
+
+public:
+    // Settings, before the first submit
+    int num_workers;        // 0 for one per core, up to 4
+    size_t max_batch;
+    SyncPolicy sync_policy;
+
+    SaveQueue();
+    ~SaveQueue();
+
+    // Queue the chunk to be saved if it's modified
+    void submit(Chunk *chunk);
+    // Wait until everything submitted so far is written or given up on.
+    // Returns false if any of it was given up on, here or since the last
+    // flush. With progress, prints how far along it is every half second.
+    bool flush(bool progress = false);
+    // Chunks given up on since the last call
+    void takeFailed(std::vector<ChunkPos>& chunks);
+    // Wait until nothing is queued for this chunk
+    void waitFor(const ChunkPos& cp);
+    // Flush, then end the threads
+    void stop();
+};
+
+#endif
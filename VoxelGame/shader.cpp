@@ -8,6 +8,9 @@
 
 #include "shader.hpp"
 #include "filelocator.hpp"
+#include "framestats.hpp"
+
+unsigned int Shader::current_program = 0;
 
 static unsigned int compileShader(int shader_type, const char *code)
 {
@@ -62,15 +65,20 @@ static unsigned int setupShaders(const char *vertexShaderSource, const char *fra
 Shader::Shader(const char* vertex, const char* fragment)
 {
     ID = 0;
+    vertexPath = vertex;
+    fragmentPath = fragment;
+}
+
+void Shader::compile()
+{
+    std::string vertexFile = FileLocator::instance.shader(vertexPath);
+    std::string fragmentFile = FileLocator::instance.shader(fragmentPath);
     
-    std::string vertexPath = FileLocator::instance.shader(vertex);
-    std::string fragmentPath = FileLocator::instance.shader(fragment);
-    
-    std::cout << "vertex: " << vertexPath << " frag: " << fragmentPath << std::endl;
+    std::cout << "vertex: " << vertexFile << " frag: " << fragmentFile << std::endl;
     
     // 1. retrieve the vertex/fragment source code from filePath
-    // std::string vertexCode;
-    // std::string fragmentCode;
+    std::string vertexCode;
+    std::string fragmentCode;
     std::ifstream vShaderFile;
     std::ifstream fShaderFile;
     // ensure ifstream objects can throw exceptions:
@@ -78,8 +86,8 @@ Shader::Shader(const char* vertex, const char* fragment)
     fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
     try {
         // open files
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
+        vShaderFile.open(vertexFile);
+        fShaderFile.open(fragmentFile);
         std::stringstream vShaderStream, fShaderStream;
         // read file's buffer contents into streams
         vShaderStream << vShaderFile.rdbuf();
@@ -94,41 +102,71 @@ Shader::Shader(const char* vertex, const char* fragment)
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         exit(-1);
     }
+    
+    ID = setupShaders(vertexCode.c_str(), fragmentCode.c_str());
+    cacheUniformLocations();
 }
 
-void Shader::compile()
+void Shader::cacheUniformLocations()
 {
-    const char* vertexShaderCode = vertexCode.c_str();
-    const char* fragmentShaderCode = fragmentCode.c_str();
-    ID = setupShaders(vertexShaderCode, fragmentShaderCode);
+    int count = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    for (int i=0; i<count; i++) {
+        char name[256];
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(ID, i, sizeof(name), &length, &size, &type, name);
+        uniform_locations[std::string(name, length)] = glGetUniformLocation(ID, name);
+    }
 }
 
 void Shader::use()
 {
     if (!ID) compile();
+    if (current_program == ID) {
+        FrameStats::instance.add(FrameStats::BINDS_SKIPPED, 1);
+        return;
+    }
     glUseProgram(ID);
+    current_program = ID;
+    FrameStats::instance.add(FrameStats::SHADER_BINDS, 1);
 }  
 
+int Shader::uniformLocation(const std::string &name)
+{
+    if (!ID) compile();
+    auto i = uniform_locations.find(name);
+    if (i == uniform_locations.end()) return -1;
+    return i->second;
+}
+
 void Shader::setBool(const std::string &name, bool value)
 {   
     use();
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+    glUniform1i(uniformLocation(name), (int)value); 
 }
 
 void Shader::setInt(const std::string &name, int value)
 { 
     use();
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+    glUniform1i(uniformLocation(name), value); 
 }
 
 void Shader::setFloat(const std::string &name, float value)
 { 
     use();
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+    glUniform1f(uniformLocation(name), value); 
 } 
 
 void Shader::setMat4(const std::string &name, const glm::mat4& matrix)
+{
+    setMat4(uniformLocation(name), matrix);
+}
+
+void Shader::setMat4(int location, const glm::mat4& matrix)
 {
     use();
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(matrix)); 
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(matrix));
+    FrameStats::instance.add(FrameStats::UNIFORM_UPDATES, 1);
 }
@@ -2,6 +2,7 @@
 #define SHADER_H
 
 #include <string>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -9,11 +10,19 @@ class Shader
 {
 private:
     unsigned int ID;
-    std::string vertexCode;
-    std::string fragmentCode;
+    std::string vertexPath;
+    std::string fragmentPath;
+    // Looked up once when the program is linked
+    std::unordered_map<std::string, int> uniform_locations;
+    
+    // Program last passed to glUseProgram, so use() can skip repeats
+    static unsigned int current_program;
+    
+    void cacheUniformLocations();
   
 public:
-    // constructor reads and builds the shader
+    // Sources are read and built on first use, so shaders can be declared
+    // statically and tools that never draw don't need the shader files.
     Shader(const char* vertexPath, const char* fragmentPath);
     
     // use/activate the shader
@@ -25,6 +34,10 @@ public:
     void setInt(const std::string &name, int value);   
     void setFloat(const std::string &name, float value);
     void setMat4(const std::string &name, const glm::mat4& matrix);
+    
+    // -1 if the program has no such uniform, which GL ignores
+    int uniformLocation(const std::string &name);
+    void setMat4(int location, const glm::mat4& matrix);
 };
   
 #endif
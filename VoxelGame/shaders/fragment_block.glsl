@@ -3,9 +3,9 @@
 out vec4 FragColor;
 in vec3 FragPos;
 in vec3 Normal;
-in vec2 TexCoord;
+in vec3 TexCoord;
 
-uniform sampler2D ourTexture;
+uniform sampler2DArray ourTexture;
 
 void main()
 {
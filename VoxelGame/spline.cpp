@@ -1,5 +1,11 @@
 #include "spline.hpp"
 #include <algorithm>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SPLINE_SSE 1
+#include <xmmintrin.h>
+#endif
 
 void Spline::compute_coefficients()
 {
@@ -109,6 +115,116 @@ double Spline2D::compute(double x, double y)
     // return (zx + zy) * 0.5;
 }
 
+SplineGrid::SplineGrid(int n)
+{
+    if (n < 2) n = 2;
+    if (n > max_size) n = max_size;
+    size = n;
+    stride = padded(n);
+    
+    // Padding samples get zero weights
+    memset(w_p0, 0, sizeof(w_p0));
+    memset(w_p1, 0, sizeof(w_p1));
+    memset(w_p2, 0, sizeof(w_p2));
+    memset(w_v0, 0, sizeof(w_v0));
+    memset(w_v2, 0, sizeof(w_v2));
+    memset(w_l0, 0, sizeof(w_l0));
+    memset(w_l1, 0, sizeof(w_l1));
+    memset(w_l2, 0, sizeof(w_l2));
+    
+    // A spline is linear in its control values, so its weights are what it
+    // computes with one control value set and the rest zero
+    Spline unit[5];
+    for (int k=0; k<5; k++) {
+        Spline& s(unit[k]);
+        s.p0 = k==0;
+        s.p1 = k==1;
+        s.p2 = k==2;
+        s.v0 = k==3;
+        s.v2 = k==4;
+        s.compute_coefficients();
+    }
+    
+    for (int i=0; i<n; i++) {
+        double t = (double)i / (n-1);
+        w_p0[i] = unit[0].compute(t);
+        w_p1[i] = unit[1].compute(t);
+        w_p2[i] = unit[2].compute(t);
+        w_v0[i] = unit[3].compute(t);
+        w_v2[i] = unit[4].compute(t);
+        if (t < 0.5) {
+            w_l0[i] = 1 - 2*t;
+            w_l1[i] = 2*t;
+        } else {
+            w_l1[i] = 1 - 2*(t-0.5);
+            w_l2[i] = 2*(t-0.5);
+        }
+    }
+}
+
+// One spline at every sample of the grid
+static void compute_samples(const SplineGrid& g, const Spline& s, float *out)
+{
+    float p0 = s.p0, p1 = s.p1, p2 = s.p2, v0 = s.v0, v2 = s.v2;
+#ifdef SPLINE_SSE
+    __m128 P0 = _mm_set1_ps(p0), P1 = _mm_set1_ps(p1), P2 = _mm_set1_ps(p2);
+    __m128 V0 = _mm_set1_ps(v0), V2 = _mm_set1_ps(v2);
+    for (int i=0; i<g.stride; i+=4) {
+        __m128 z = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(P0, _mm_load_ps(g.w_p0 + i)), _mm_mul_ps(P1, _mm_load_ps(g.w_p1 + i))),
+            _mm_add_ps(_mm_mul_ps(P2, _mm_load_ps(g.w_p2 + i)),
+                _mm_add_ps(_mm_mul_ps(V0, _mm_load_ps(g.w_v0 + i)), _mm_mul_ps(V2, _mm_load_ps(g.w_v2 + i)))));
+        _mm_store_ps(out + i, z);
+    }
+#else
+    for (int i=0; i<g.stride; i++) {
+        out[i] = p0*g.w_p0[i] + p1*g.w_p1[i] + p2*g.w_p2[i] + v0*g.w_v0[i] + v2*g.w_v2[i];
+    }
+#endif
+}
+
+void Spline2D::compute_grid(const SplineGrid& g, float *out) const
+{
+    // The x splines run along y and are blended across x, so for a row
+    // they're three constants. The y splines are the other way around.
+    alignas(16) float sx[3][SplineGrid::max_size];
+    alignas(16) float sy[3][SplineGrid::max_size];
+    compute_samples(g, x0, sx[0]);
+    compute_samples(g, x1, sx[1]);
+    compute_samples(g, x2, sx[2]);
+    compute_samples(g, y0, sy[0]);
+    compute_samples(g, y1, sy[1]);
+    compute_samples(g, y2, sy[2]);
+    
+    for (int j=0; j<g.size; j++) {
+        float *row = out + j * g.stride;
+#ifdef SPLINE_SSE
+        __m128 X0 = _mm_set1_ps(sx[0][j]), X1 = _mm_set1_ps(sx[1][j]), X2 = _mm_set1_ps(sx[2][j]);
+        __m128 L0 = _mm_set1_ps(g.w_l0[j]), L1 = _mm_set1_ps(g.w_l1[j]), L2 = _mm_set1_ps(g.w_l2[j]);
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+        for (int i=0; i<g.stride; i+=4) {
+            __m128 zx = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(X0, _mm_load_ps(g.w_l0 + i)), _mm_mul_ps(X1, _mm_load_ps(g.w_l1 + i))),
+                _mm_mul_ps(X2, _mm_load_ps(g.w_l2 + i)));
+            __m128 zy = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(L0, _mm_load_ps(sy[0] + i)), _mm_mul_ps(L1, _mm_load_ps(sy[1] + i))),
+                _mm_mul_ps(L2, _mm_load_ps(sy[2] + i)));
+            __m128 z = _mm_sqrt_ps(_mm_mul_ps(_mm_max_ps(zx, zero), _mm_max_ps(zy, zero)));
+            _mm_storeu_ps(row + i, _mm_min_ps(z, one));
+        }
+#else
+        float x0 = sx[0][j], x1 = sx[1][j], x2 = sx[2][j];
+        float l0 = g.w_l0[j], l1 = g.w_l1[j], l2 = g.w_l2[j];
+        for (int i=0; i<g.stride; i++) {
+            float zx = x0*g.w_l0[i] + x1*g.w_l1[i] + x2*g.w_l2[i];
+            float zy = l0*sy[0][i] + l1*sy[1][i] + l2*sy[2][i];
+            float z = sqrtf(std::max(zx, 0.0f) * std::max(zy, 0.0f));
+            row[i] = std::min(z, 1.0f);
+        }
+#endif
+    }
+}
+
 Spline2D::Spline2D()
 {
     z00 = 0;
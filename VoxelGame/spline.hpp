@@ -14,6 +14,30 @@ struct Spline {
     double compute(double x);
 };
 
+// Sample positions i/(n-1) for i = 0..n-1, the same along both axes of a
+// Spline2D, with each position's weights worked out ahead of time. Which
+// half of the unit interval a sample falls in is folded into its weights,
+// so evaluating a grid takes no branches.
+struct SplineGrid {
+    static constexpr int max_size = 32;
+    int size;
+    // Output rows are padded to a multiple of 4 floats
+    int stride;
+    // Spline::compute(t) == p0*w_p0 + p1*w_p1 + p2*w_p2 + v0*w_v0 + v2*w_v2
+    alignas(16) float w_p0[max_size];
+    alignas(16) float w_p1[max_size];
+    alignas(16) float w_p2[max_size];
+    alignas(16) float w_v0[max_size];
+    alignas(16) float w_v2[max_size];
+    // Linear blend between the splines at 0, 0.5 and 1
+    alignas(16) float w_l0[max_size];
+    alignas(16) float w_l1[max_size];
+    alignas(16) float w_l2[max_size];
+    
+    SplineGrid(int n);
+    static constexpr int padded(int n) { return (n + 3) & ~3; }
+};
+
 struct Spline2D {
     double z00, z10, z20;
     double z01, z11, z21;
@@ -29,6 +53,9 @@ struct Spline2D {
     Spline2D();
     void compute_coefficients();
     double compute(double x, double y);
+    // compute() at every point of the grid, in float. Row j holds y = j/(n-1)
+    // and starts at out + j*grid.stride.
+    void compute_grid(const SplineGrid& grid, float *out) const;
 };
 
 #endif
\ No newline at end of file
@@ -4,9 +4,46 @@
 #include <iostream>
 #include "filelocator.hpp"
 #include "texture.hpp"
+#include "framestats.hpp"
 
 TextureLibrary TextureLibrary::instance;
 
+// What's bound to each texture unit, so binding the same texture again can
+// be skipped. All binds and unit switches go through here.
+static const int max_texture_units = 16;
+static unsigned int bound_2d[max_texture_units];
+static unsigned int bound_array[max_texture_units];
+static int active_unit = 0;
+
+static void selectUnit(int unit)
+{
+    if (unit == active_unit) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+}
+
+// Binds to the active unit
+static void bindTexture(unsigned int target, unsigned int id)
+{
+    unsigned int& bound(target == GL_TEXTURE_2D_ARRAY ? bound_array[active_unit] : bound_2d[active_unit]);
+    if (bound == id) {
+        FrameStats::instance.add(FrameStats::BINDS_SKIPPED, 1);
+        return;
+    }
+    glBindTexture(target, id);
+    bound = id;
+    FrameStats::instance.add(FrameStats::TEXTURE_BINDS, 1);
+}
+
+// Deleting a texture unbinds it everywhere
+static void forgetTexture(unsigned int id)
+{
+    for (int i=0; i<max_texture_units; i++) {
+        if (bound_2d[i] == id) bound_2d[i] = 0;
+        if (bound_array[i] == id) bound_array[i] = 0;
+    }
+}
+
 
 // static std::string base_dir("/Users/millerti/tinker/voxelgame/textures/");
 
@@ -14,7 +51,7 @@ unsigned int Texture::openGL_load_texture()
 {
     unsigned int texID;
     glGenTextures(1, &texID); // XXX check for failure
-    glBindTexture(GL_TEXTURE_2D, texID); 
+    bindTexture(GL_TEXTURE_2D, texID);
     
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
@@ -47,7 +84,7 @@ void Texture::load_image_file(const std::string& name)
     if (!data) {
         // XXX Push error up to UI
         std::cerr << "Failed to load image\n";
-        exit(0);
+        exit(1);
         return;
     }
     std::cout << name << " width=" << width << " height=" << height << " nc=" << nrChannels << std::endl;
@@ -69,19 +106,70 @@ Texture::Texture(const std::string& name) : tex_name(name)
     inverse_width = 0;
     inverse_height = 0;
     nearest_filter = false;
+    array_index = -1;
+    layer = 0;
     
     load_image_file(name);
 }
 
 Texture::~Texture()
 {
-    if (texID) glDeleteTextures(1, &texID);
+    if (texID) {
+        glDeleteTextures(1, &texID);
+        forgetTexture(texID);
+    }
     if (data) stbi_image_free(data);
 }
 
 void Texture::use(int texture_unit) {
-    glActiveTexture(GL_TEXTURE0 + texture_unit);
-    glBindTexture(GL_TEXTURE_2D, getID());
+    selectUnit(texture_unit);
+    bindTexture(GL_TEXTURE_2D, getID());
+}
+
+
+TextureArray::~TextureArray()
+{
+    if (texID) {
+        glDeleteTextures(1, &texID);
+        forgetTexture(texID);
+    }
+}
+
+int TextureArray::addLayer(const unsigned char *data)
+{
+    size_t layer_size = (size_t)width * height * 4;
+    pixels.insert(pixels.end(), data, data + layer_size);
+    return num_layers++;
+}
+
+void TextureArray::openGL_load_texture()
+{
+    if (!texID) glGenTextures(1, &texID); // XXX check for failure
+    bindTexture(GL_TEXTURE_2D_ARRAY, texID);
+    
+    // Same wrapping and filtering as single textures
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    if (nearest_filter) {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    } else {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width, height, num_layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data()); // XXX check for failure
+    uploaded_layers = num_layers;
+}
+
+void TextureArray::use(int texture_unit)
+{
+    selectUnit(texture_unit);
+    if (uploaded_layers != num_layers) {
+        openGL_load_texture();
+    } else {
+        bindTexture(GL_TEXTURE_2D_ARRAY, texID);
+    }
 }
 
 
@@ -104,6 +192,23 @@ TextureLibrary::~TextureLibrary()
     for (auto i = texture_list.begin(); i != texture_list.end(); ++i) {
         delete *i;
     }
+    for (auto i = array_list.begin(); i != array_list.end(); ++i) {
+        delete *i;
+    }
+}
+
+void TextureLibrary::add_to_array(Texture *t)
+{
+    int w = t->getWidth(), h = t->getHeight();
+    bool nearest = t->isNearest();
+    size_t a;
+    for (a=0; a<array_list.size(); a++) {
+        if (array_list[a]->matches(w, h, nearest)) break;
+    }
+    if (a == array_list.size()) array_list.push_back(new TextureArray(w, h, nearest));
+    
+    int layer = array_list[a]->addLayer(t->getPixels());
+    t->setArrayLayer((int)a, layer);
 }
 
 int TextureLibrary::load_texture(const std::string& name)
@@ -111,6 +216,7 @@ int TextureLibrary::load_texture(const std::string& name)
     Texture *t = new Texture(name);
     size_t index = texture_list.size();
     texture_map[name] = (int)index;
+    add_to_array(t);
     texture_list.push_back(t);
     return (int)index;
 }
@@ -19,6 +19,8 @@ private:
     std::string tex_name;
     unsigned char *data;
     bool nearest_filter;
+    // Where this texture lives in TextureLibrary's arrays
+    int array_index, layer;
     
     void load_image_file(const std::string& name);
     unsigned int openGL_load_texture();
@@ -40,6 +42,44 @@ public:
     }
     
     const std::string& getName() { return tex_name; }
+    bool isNearest() { return nearest_filter; }
+    // Only valid until the texture is first loaded into GL
+    const unsigned char *getPixels() { return data; }
+    
+    void setArrayLayer(int a, int l) { array_index = a; layer = l; }
+    int getArrayIndex() { return array_index; }
+    int getLayer() { return layer; }
+    
+    void use(int texture_unit);
+};
+
+/*
+Textures of the same size and filtering, packed into one GL_TEXTURE_2D_ARRAY
+so that geometry using any of them can go in a single draw. Texture
+coordinates for an array carry the layer as a third component. Pixels are
+kept so the array can be uploaded again if layers are added after first use.
+*/
+class TextureArray {
+private:
+    unsigned int texID;
+    int width, height;
+    bool nearest_filter;
+    std::vector<unsigned char> pixels;
+    int num_layers, uploaded_layers;
+    
+    void openGL_load_texture();
+    
+public:
+    TextureArray(int w, int h, bool nearest) : texID(0), width(w), height(h), nearest_filter(nearest),
+        num_layers(0), uploaded_layers(0) {}
+    ~TextureArray();
+    
+    bool matches(int w, int h, bool nearest) {
+        return width == w && height == h && nearest_filter == nearest;
+    }
+    // Copy in one layer of RGBA pixels, returning its index
+    int addLayer(const unsigned char *data);
+    int numLayers() { return num_layers; }
     
     void use(int texture_unit);
 };
@@ -51,7 +91,9 @@ public:
 private:
     std::vector<Texture *> texture_list;
     std::unordered_map<std::string, int> texture_map;
+    std::vector<TextureArray *> array_list;
     int load_texture(const std::string& name);
+    void add_to_array(Texture *t);
     
 public:
     TextureLibrary() {}
@@ -72,6 +114,14 @@ public:
         return texture_list.size();
     }
     
+    TextureArray *getArray(int index) {
+        return array_list[index];
+    }
+    
+    size_t numArrays() {
+        return array_list.size();
+    }
+    
     // void free(const std::string& name);
     
     // std::unordered_map<std::string, Texture *>& getMap() {
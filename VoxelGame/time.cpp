@@ -1,7 +1,10 @@
 #include "time.hpp"
-#include "gl_includes.hpp"
+#include <chrono>
 
+// Seconds since the first call. Kept independent of GLFW so headless tools
+// can use it without a window.
 double ref::currentTime()
 {
-    return glfwGetTime();
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
@@ -0,0 +1,108 @@
+#include "transsort.hpp"
+#include "chunkview.hpp"
+#include <glm/gtx/norm.hpp>
+#include <algorithm>
+
+// Insertion sort, far to near. Cheap when the input is already almost in
+// order, which is the usual case from one frame to the next.
+template<typename T, typename D>
+static void insertionSortFarToNear(std::vector<T>& list, D dist)
+{
+    size_t n = list.size();
+    for (size_t i=1; i<n; i++) {
+        T x = list[i];
+        double dx = dist(x);
+        size_t j = i;
+        while (j>0 && dist(list[j-1]) < dx) {
+            list[j] = list[j-1];
+            j--;
+        }
+        list[j] = x;
+    }
+}
+
+void TransSorter::sortEntry(ChunkEntry& entry, bool full)
+{
+    entry.dist = glm::length2(entry.middle - sort_camera);
+    for (Item& item : entry.items) {
+        item.dist = glm::length2(item.render->position - sort_camera);
+    }
+
+    if (full) {
+        // Freshly copied from the chunk, so no useful prior order
+        std::sort(entry.items.begin(), entry.items.end(),
+            [](const Item& a, const Item& b) -> bool {
+                return b.dist < a.dist;
+            });
+    } else {
+        insertionSortFarToNear(entry.items, [](const Item& item) { return item.dist; });
+    }
+}
+
+void TransSorter::sortOrder()
+{
+    insertionSortFarToNear(order, [](const ChunkEntry *entry) { return entry->dist; });
+}
+
+bool TransSorter::update(const std::vector<Chunk *>& chunks, const glm::dvec3& camera_pos)
+{
+    bool moved = !have_sort || glm::length2(camera_pos - sort_camera) > resort_distance * resort_distance;
+    if (moved) {
+        sort_camera = camera_pos;
+        have_sort = true;
+    }
+
+    for (auto i=entries.begin(); i!=entries.end(); ++i) i->second.seen = false;
+
+    bool changed = false;
+    for (Chunk *chunk : chunks) {
+        ChunkView *view = chunk->getView();
+        unsigned int generation;
+        const std::vector<Renderer *> *trans = view->getTransRenders(generation);
+        if (!trans || trans->empty()) continue;
+
+        auto found = entries.find(view);
+        if (found != entries.end() && found->second.generation == generation) {
+            found->second.seen = true;
+            if (moved) sortEntry(found->second, false);
+            continue;
+        }
+
+        if (found == entries.end()) {
+            ChunkEntry& entry(entries[view]);
+            entry.view = view;
+            BlockPos corner = BlockPos::getBlockPos(chunk->getChunkPos());
+            entry.middle = glm::dvec3(corner.X + 8, corner.Y + 8, corner.Z + 8);
+            order.push_back(&entry);
+            found = entries.find(view);
+        }
+
+        ChunkEntry& entry(found->second);
+        entry.generation = generation;
+        entry.seen = true;
+        entry.items.clear();
+        for (Renderer *r : *trans) {
+            if (r) entry.items.push_back(Item{0, r});
+        }
+        sortEntry(entry, true);
+        changed = true;
+    }
+
+    // Forget chunks that were unloaded or no longer have translucent blocks
+    size_t before = order.size();
+    order.erase(std::remove_if(order.begin(), order.end(),
+        [](ChunkEntry *entry) { return !entry->seen; }), order.end());
+    if (order.size() != before) {
+        for (auto i=entries.begin(); i!=entries.end(); ) {
+            if (!i->second.seen) {
+                i = entries.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        changed = true;
+    }
+
+    if (moved || changed) sortOrder();
+    return moved || changed;
+}
@@ -0,0 +1,64 @@
+#ifndef INCLUDED_TRANS_SORT_HPP
+#define INCLUDED_TRANS_SORT_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+class Chunk;
+class ChunkView;
+class Renderer;
+
+/*
+Back-to-front ordering of translucent renderers that is kept from frame to
+frame. Chunks are ordered far to near by their centers, and the renderers
+within each chunk are ordered far to near by their positions. Because the
+camera moves only a little between frames, both levels are re-sorted with
+insertion sort, which is close to linear on nearly-sorted input. Nothing is
+re-sorted unless the camera has moved more than resort_distance or some
+chunk has published a new set of translucent renderers.
+*/
+
+class TransSorter {
+private:
+    struct Item {
+        double dist;    // squared distance from sort_camera
+        Renderer *render;
+    };
+
+    struct ChunkEntry {
+        ChunkView *view;
+        unsigned int generation;
+        glm::dvec3 middle;
+        double dist;    // squared distance from sort_camera
+        bool seen;
+        std::vector<Item> items;    // far to near
+    };
+
+    std::unordered_map<ChunkView *, ChunkEntry> entries;
+    std::vector<ChunkEntry *> order;    // far to near
+    glm::dvec3 sort_camera;
+    bool have_sort;
+
+    void sortEntry(ChunkEntry& entry, bool full);
+    void sortOrder();
+
+public:
+    double resort_distance;
+
+    TransSorter() : have_sort(false), resort_distance(0.25) {}
+
+    // Bring the ordering up to date for this frame. Returns true if anything
+    // was re-sorted.
+    bool update(const std::vector<Chunk *>& chunks, const glm::dvec3& camera_pos);
+
+    // Visit every translucent renderer from far to near
+    template<typename F>
+    void forEach(F func) {
+        for (ChunkEntry *entry : order) {
+            for (Item& item : entry->items) func(item.render);
+        }
+    }
+};
+
+#endif
@@ -227,10 +227,10 @@ std::string UIElements::drawBlockMenu(int window_width, int window_height, doubl
     
         RenderData *render_data = blocklist_render->getData();
         render_data->clear();
-        mesh->getTriangleVertices(facing::ALL_FACES, render_data->vertices, BlockPos(0,0,0), BlockPos(0,0,0));
-        mesh->getTriangleTexCoords(facing::ALL_FACES, render_data->texcoords);
-        mesh->getTriangleNormals(facing::ALL_FACES, render_data->normals);
-        render_data->total_vertices += mesh->numTriangleVertices(facing::ALL_FACES);
+        mesh->getQuadVertices(facing::ALL_FACES, render_data->vertices, BlockPos(0,0,0), BlockPos(0,0,0));
+        mesh->getQuadTexCoords(facing::ALL_FACES, render_data->texcoords);
+        mesh->getQuadNormals(facing::ALL_FACES, render_data->normals);
+        render_data->total_vertices += mesh->numQuadVertices(facing::ALL_FACES);
     
         blocklist_render->load_buffers();
         blocklist_render->draw(&blocklistShader);    
@@ -28,7 +28,7 @@ public:
         crossShader("vertex_cross.glsl", "fragment_cross.glsl"),
         blocklistShader("vertex_blocklist.glsl", "fragment_blocklist.glsl")
     {
-        blocklist_render = new Renderer(0);
+        blocklist_render = new Renderer((Texture *)0);
     }
     
     ~UIElements() {
@@ -44,7 +44,7 @@ void Window::create()
         return;
     }
 
- #ifdef __APPLE__
+ #if defined(__APPLE__) || defined(__linux__)
     /* We need to explicitly ask for a 3.3 context on OS X */
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
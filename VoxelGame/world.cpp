@@ -5,7 +5,10 @@
 #include <glm/gtx/string_cast.hpp>
 #include "time.hpp"
 #include "filelocator.hpp"
-#ifdef __APPLE__
+#include "editjournal.hpp"
+#include "savequeue.hpp"
+#include "chunkcodec.hpp"
+#if defined(__APPLE__) || defined(__linux__)
 #include <unistd.h>
 #endif
 #include <filesystem>
@@ -151,7 +154,7 @@ void World::repaintBlocks(const BlockPos *pos, size_t count)
     }
 }
 
-void World::doBlockUpdates()
+int World::doBlockUpdates()
 {
     int start_repaint, did_repaint, after_repaint, remain_repaint;
     
@@ -252,6 +255,8 @@ void World::doBlockUpdates()
         
         // std::cout << "Repaints: start=" << start_repaint << " did=" << did_repaint << " after=" << after_repaint << " remain=" << remain_repaint << std::endl;
     }
+    
+    return (int)(load_pos.size() + no_load_pos.size() + repaint_pos.size());
 }
 
 void World::updateSurroundingBlocks(const BlockPos& pos, bool no_load)
@@ -438,9 +443,14 @@ void World::allIntersectingCollisions(std::vector<geom::Box>& collisions, const
 }
 
 
+// Chunks whose changes are all in the journal are safe already, so they can
+// collect more edits before being written
+static const double save_delay = 5;
+static const double journaled_save_delay = 60;
+
 Chunk* World::nextSaveChunk()
 {
-    // Find a modified chunk saved more than 5 seconds in the past
+    // Find a modified chunk saved more than save_delay seconds in the past
     Chunk *oldest = 0;
     {
         double min_time = 0;
@@ -457,22 +467,54 @@ Chunk* World::nextSaveChunk()
     if (!oldest) return 0;
     double now = ref::currentTime();
     double age = now - oldest->last_save;
-    if (age < 5) return 0;
+    if (age < (oldest->journaled ? journaled_save_delay : save_delay)) return 0;
     return oldest;
 }
 
+// Only takes a copy; SaveQueue does the rest
 void World::saveChunk(Chunk* chunk)
 {
-    chunk->save();
+    SaveQueue::instance.submit(chunk);
 }
 
 void World::saveAll()
 {
-    std::unique_lock<spinlock> lock(storage_mutex);
-    for (auto i=chunk_storage.begin(); i!=chunk_storage.end(); ++i) {
-        Chunk *chunk = i->second;
-        saveChunk(chunk);
+    // Edits after this go to a new journal file, and the chunks they're in
+    // will be saved again later
+    uint64_t journal_seq = EditJournal::instance.beginCheckpoint();
+    {
+        std::unique_lock<spinlock> lock(storage_mutex);
+        for (auto i=chunk_storage.begin(); i!=chunk_storage.end(); ++i) {
+            Chunk *chunk = i->second;
+            saveChunk(chunk);
+        }
+        for (Chunk *chunk : chunk_unload_queue) saveChunk(chunk);
     }
+    if (SaveQueue::instance.flush(true)) {
+        EditJournal::instance.finishCheckpoint(journal_seq);
+    } else {
+        // Their edits are still in the journal
+        std::cout << "Keeping the edit journal, since some chunks couldn't be saved" << std::endl;
+    }
+}
+
+void World::recoverJournal()
+{
+    std::vector<EditJournal::Edit> edits;
+    EditJournal::instance.recover(edits);
+    if (edits.empty()) return;
+    
+    // Chunks saved after an edit already have it, along with anything done
+    // to them since that wasn't journaled
+    size_t replayed = 0;
+    for (const EditJournal::Edit& edit : edits) {
+        Chunk *chunk = getChunk(edit.pos.getChunkPos());
+        if (edit.record <= chunk->journal_record) continue;
+        chunk->replayBlock(edit.pos, edit.name, edit.rotation, edit.record);
+        replayed++;
+    }
+    std::cout << "Replayed " << replayed << " of " << edits.size() << " journaled edits" << std::endl;
+    saveAll();
 }
 
 void World::unloadChunkUnlocked(const ChunkPos& cp)
@@ -553,7 +595,7 @@ void World::blockUpdateThreadLoop()
 {
     while (bu_thread_alive) {
         // std::cout << "loadSaveThreadLoop\n";
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
         usleep(10000);
 #endif
 #if defined _WIN32 || defined _WIN64
@@ -575,10 +617,15 @@ void World::stopLoadSaveThread()
         delete loadSaveThread;
         loadSaveThread = 0;
     }
+    SaveQueue::instance.stop();
 }
 
 void World::startLoadSaveThread()
 {
+    ChunkCodec::instance.openWorld();
+    // Before any other thread can edit blocks. An edit journaled first
+    // would give its chunk a newer record than the ones being replayed.
+    recoverJournal();
     ls_thread_alive = true;
     loadSaveThread = new std::thread(&World::loadSaveThreadLoop, this);
 }
@@ -693,9 +740,10 @@ void World::loadUnloadChunks(const ChunkPos& center)
 void World::loadSaveThreadLoop()
 {
     // loadKnownChunks();
+    std::vector<ChunkPos> failed_saves;
     while (ls_thread_alive) {
         // std::cout << "loadSaveThreadLoop\n";
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
         usleep(10000);
 #endif
 #if defined _WIN32 || defined _WIN64
@@ -710,6 +758,16 @@ void World::loadSaveThreadLoop()
         
         dequeueUnloadedChunk();
         
+        // Chunks SaveQueue couldn't write get another go later, if they're
+        // still loaded
+        SaveQueue::instance.takeFailed(failed_saves);
+        for (const ChunkPos& cp : failed_saves) {
+            Chunk *chunk = getChunk(cp, World::NoLoad);
+            if (chunk) chunk->markDataModified();
+        }
+        
+        if (EditJournal::instance.wantsCheckpoint()) saveAll();
+        
         // unloadSomeChunk();
     }
 }
@@ -735,48 +793,6 @@ void World::loadSaveThreadLoop()
 //     });
 // }
 
-static bool parse_chunk_coords(const char *str, int *arr)
-{
-    while (*str && *str!='(') str++;
-    if (*str != '(') return false;
-    str++;
-    arr[0] = atoi(str);
-
-    while (*str && *str!=',') str++;
-    if (*str != ',') return false;
-    str++;
-    arr[1] = atoi(str);
-    
-    while (*str && *str!=',') str++;
-    if (*str != ',') return false;
-    str++;
-    arr[2] = atoi(str);
-    
-    return true;
-}
-
-// void World::loadKnownChunks()
-// {
-//     bool ok;
-//
-//     known_chunks.clear();
-//
-//     std::string path = FileLocator::instance.chunk("");
-//     for (const auto& entry : std::filesystem::directory_iterator(path)) {
-//         const std::string& path(entry.path().string());
-//         std::size_t found = path.find_last_of("/\\");
-//         if (found == std::string::npos) continue;
-//         const char *fname = path.c_str() + found + 1;
-//         int xyz[3];
-//         ok = parse_chunk_coords(fname, xyz);
-//         if (!ok) continue;
-//
-//         known_chunks.emplace_back(xyz[0], xyz[1], xyz[2]);
-//         // std::cout << fname << " -> " << known_chunks.back().toString() << std::endl;
-//     }
-// }
-
-
 void World::startTickThread()
 {
     tick_thread_alive = true;
@@ -805,7 +821,7 @@ void World::tickThreadLoop()
         double elapsed = after_ticking - before_ticking;
         double sleep_needed = 0.05 - elapsed;
         if (sleep_needed > 0) {
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
             usleep((int)(sleep_needed * 1000000.0));
 #endif
 #if defined _WIN32 || defined _WIN64
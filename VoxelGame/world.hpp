@@ -113,7 +113,8 @@ public:
     void updateSurroundingBlocks(const BlockPos& pos, bool no_load=false);
     void repaintSurroundingBlocks(const BlockPos& pos);
     
-    void doBlockUpdates();
+    // Returns the number of updates and repaints processed
+    int doBlockUpdates();
             
     Chunk* getChunkUnlocked(const ChunkPos& pos, bool no_load) {
         uint64_t packed = pos.packed();
@@ -223,7 +224,12 @@ public:
         unloadChunkUnlocked(cp);
     }
     void dequeueUnloadedChunk();
+    // Saves every modified chunk, loaded or waiting to be unloaded, and
+    // waits for it to be written. This is also a checkpoint of the
+    // EditJournal.
     void saveAll();
+    // Reapply edits journaled by a run that didn't get to save them
+    void recoverJournal();
     
     
     void addEntity(EntityPtr p) {
@@ -7,20 +7,24 @@
 #include <glm/gtx/norm.hpp>
 #include "geometry.hpp"
 #include "blocklibrary.hpp"
+#include "framestats.hpp"
+#include "time.hpp"
+#include "meshcache.hpp"
 
 WorldView WorldView::instance;
 
 void WorldView::computeChunkRenders(const glm::dvec3& camera_pos, const glm::mat4& projection, CameraModel *camera)
 {    
-    std::vector<Chunk *> chunks;
     BlockPos center = geom::computeCenter(camera_pos);
     glm::mat4 view_matrix = camera->getViewMatrix(center.X, center.Y, center.Z);
+    Frustum frustum(projection * view_matrix);
     
-    World::instance.listAllChunks(chunks);
-    for (auto i=chunks.begin(); i!=chunks.end(); ++i) {
+    World::instance.listAllChunks(compute_chunks);
+    compute_culler.cull(frustum, center, compute_chunks, compute_visible);
+    for (auto i=compute_visible.begin(); i!=compute_visible.end(); ++i) {
         Chunk *chunk = *i;
         ChunkView *view = chunk->getView();
-        view->computeUpdates(center, projection, view_matrix);
+        view->computeUpdates(center);
     }
 }
 
@@ -38,20 +42,42 @@ void WorldView::computeEntityRenders(const glm::dvec3& camera_pos, const glm::ma
 
 void WorldView::draw(CameraModel *camera)
 {
-    std::vector<Chunk *> chunks;
     std::vector<EntityPtr> entities;
     
-    World::instance.listAllChunks(chunks);
+    double cull_start = ref::currentTime();
+    BlockPos center = geom::computeCenter(camera->getPos());
+    glm::mat4 view_matrix = camera->getViewMatrix(center.X, center.Y, center.Z);
+    Frustum frustum(projection * view_matrix);
+    
+    World::instance.listAllChunks(draw_chunks);
+    draw_culler.cull(frustum, center, draw_chunks, draw_in_frustum);
+    ChunkPos camera_chunk = BlockPos(camera->getPos()).getChunkPos();
+    occlusion_culler.cull(draw_chunks, draw_in_frustum, camera_chunk, draw_visible);
+    FrameStats::instance.add(FrameStats::CULL_TIME, ref::currentTime() - cull_start);
+    FrameStats::instance.add(FrameStats::CHUNKS_LOADED, draw_chunks.size());
+    FrameStats::instance.add(FrameStats::CHUNKS_IN_FRUSTUM, draw_in_frustum.size());
+    FrameStats::instance.add(FrameStats::CHUNKS_VISIBLE, draw_visible.size());
     
     glDisable(GL_BLEND);
     
-    for (auto i=chunks.begin(); i!=chunks.end(); ++i) {
+    draw_list.clear();
+    for (auto i=draw_visible.begin(); i!=draw_visible.end(); ++i) {
         Chunk *chunk = *i;
         ChunkView *view = chunk->getView();
         if (view) {
-            view->draw(&blockShader, camera);
+            view->addDraws(draw_list, &blockShader);
         }
     }
+    int draw_calls = draw_list.submit(camera);
+    FrameStats::instance.add(FrameStats::CHUNK_DRAW_CALLS, draw_calls);
+    
+    GeometryArena& arena(GeometryArena::instance);
+    FrameStats::instance.set(FrameStats::ARENA_PAGES, arena.numPages());
+    FrameStats::instance.set(FrameStats::ARENA_USED_MB, arena.usedBytes() / 1048576.0);
+    FrameStats::instance.set(FrameStats::ARENA_CAPACITY_MB, arena.capacityBytes() / 1048576.0);
+    FrameStats::instance.set(FrameStats::ARENA_FREE_RANGES, arena.numFreeRanges());
+    FrameStats::instance.set(FrameStats::MESH_CACHE_HIT_PERCENT, MeshCache::instance.hitRate() * 100);
+    FrameStats::instance.set(FrameStats::MESH_CACHE_MB, MeshCache::instance.usedBytes() / 1048576.0);
 
     World::instance.listAllEntities(entities);
 
@@ -61,46 +87,34 @@ void WorldView::draw(CameraModel *camera)
 
     glEnable(GL_BLEND);
 
-    drawTrans(camera, chunks);
+    drawTrans(camera, draw_visible);
 }
 
 void WorldView::drawTrans(CameraModel *camera, const std::vector<Chunk *>& chunks)
 {
-    std::vector<Renderer *> trans;
-    
-    for (auto i=chunks.begin(); i!=chunks.end(); ++i) {
-        Chunk *chunk = *i;
-        ChunkView *view = chunk->getView();
-        view->copyTransRenders(trans);
-    }
-    
-    glm::dvec3 campos = camera->getPos();
-    
-    std::sort(trans.begin(), trans.end(),
-        [&campos](Renderer *a, Renderer *b) -> bool {
-            double da = glm::length2(a->position - campos);
-            double db = glm::length2(b->position - campos);
-            return db < da; // Sort from far to near
-        });
-    
-    size_t num_tex = trans.size();
-    // std::cout << "Drawing trans, num=" << num_tex << std::endl;
-    for (int i=0; i<num_tex; i++) {
-        Renderer *mr = trans[i];
-        if (!mr) continue;
+    double sort_start = ref::currentTime();
+    bool resorted = trans_sorter.update(chunks, camera->getPos());
+    FrameStats::instance.add(FrameStats::TRANS_SORT_TIME, ref::currentTime() - sort_start);
+    if (resorted) FrameStats::instance.add(FrameStats::TRANS_RESORTS, 1);
+    
+    // Order is fixed by depth, but neighbors usually share a mesh center
+    int num_drawn = 0;
+    int view_location = blockShader.uniformLocation("view");
+    bool have_center = false;
+    BlockPos last_center;
+    trans_sorter.forEach([&](Renderer *mr) {
         const BlockPos& center(mr->getCenter());
-        glm::mat4 view = camera->getViewMatrix(center.X, center.Y, center.Z);
-    
-        // if (!did_frustum_check) {
-        //     if (!insideFrustum(view, center)) return;
-        //     did_frustum_check = true;
-        // }
-    
-        blockShader.setMat4("view", view);
+        if (!have_center || !(center == last_center)) {
+            glm::mat4 view = camera->getViewMatrix(center.X, center.Y, center.Z);
+            blockShader.setMat4(view_location, view);
+            last_center = center;
+            have_center = true;
+        }
         mr->load_buffers();
         mr->draw(&blockShader);
-    }
-    
+        num_drawn++;
+    });
+    FrameStats::instance.add(FrameStats::TRANS_RENDERERS, num_drawn);
 }
 
 
@@ -119,14 +133,14 @@ void WorldView::drawOneBlock(CameraModel *camera, const BlockPos& pos, const std
     render_data->clear();
     if (rotation) {
         glm::mat4 rot_matrix = Mesh::getRotationMatrix(rotation);
-        mesh->getTriangleVertices(facing::ALL_FACES, render_data->vertices, rot_matrix, pos, center);        
-        mesh->getTriangleNormals(facing::ALL_FACES, render_data->normals, rot_matrix);
+        mesh->getQuadVertices(facing::ALL_FACES, render_data->vertices, rot_matrix, pos, center);        
+        mesh->getQuadNormals(facing::ALL_FACES, render_data->normals, rot_matrix);
     } else {
-        mesh->getTriangleVertices(facing::ALL_FACES, render_data->vertices, pos, center);
-        mesh->getTriangleNormals(facing::ALL_FACES, render_data->normals);
+        mesh->getQuadVertices(facing::ALL_FACES, render_data->vertices, pos, center);
+        mesh->getQuadNormals(facing::ALL_FACES, render_data->normals);
     }
-    mesh->getTriangleTexCoords(facing::ALL_FACES, render_data->texcoords);
-    render_data->total_vertices += mesh->numTriangleVertices(facing::ALL_FACES);
+    mesh->getQuadTexCoords(facing::ALL_FACES, render_data->texcoords);
+    render_data->total_vertices += mesh->numQuadVertices(facing::ALL_FACES);
     
     glm::mat4 view = camera->getViewMatrix(center.X, center.Y, center.Z);
     placementShader.setMat4("view", view);
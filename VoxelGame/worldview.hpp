@@ -4,6 +4,9 @@
 #include "chunkview.hpp"
 // #include "longconcurrentmap.hpp"
 #include "cameracontroller.hpp"
+#include "transsort.hpp"
+#include "frustum.hpp"
+#include "occlusion.hpp"
 
 class ChunkView;
 
@@ -16,11 +19,21 @@ private:
     Shader entityShader;
     Shader placementShader;
     Renderer *placeblock_render;
+    TransSorter trans_sorter;
+    glm::mat4 projection;
+    
+    // One culler per thread: compute_culler belongs to the chunk compute
+    // thread, draw_culler to the graphics thread
+    ChunkCuller compute_culler, draw_culler;
+    std::vector<Chunk *> compute_chunks, compute_visible;
+    std::vector<Chunk *> draw_chunks, draw_in_frustum, draw_visible;
+    OcclusionCuller occlusion_culler;
+    DrawList draw_list;
     
 public:
     WorldView() : entityShader("vertex_entity.glsl", "fragment_entity.glsl"), blockShader("vertex_block.glsl", "fragment_block.glsl"),
           placementShader("vertex_placement.glsl", "fragment_placement.glsl") {
-        placeblock_render = new Renderer(0);
+        placeblock_render = new Renderer((Texture *)0);
     }
     ~WorldView() {
         RenderManager::instance.queueDeleteRenderer(placeblock_render);
@@ -40,6 +53,7 @@ public:
     }
     
     void setProjection(const glm::mat4& matrix) {
+        projection = matrix;
         blockShader.setMat4("projection", matrix);
         entityShader.setMat4("projection", matrix);
         placementShader.setMat4("projection", matrix);